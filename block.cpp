@@ -0,0 +1,155 @@
+#include "block.h"
+
+#include "lz.h"
+
+#include <cstring>
+#include <stdexcept>
+
+static void putVarint(std::string &dst, uint64_t v) {
+    while (v >= 0x80) {
+        dst += static_cast<char>(v | 0x80);
+        v >>= 7;
+    }
+    dst += static_cast<char>(v);
+}
+
+static const char *getVarint(const char *p, const char *limit, uint64_t &v) {
+    v = 0;
+    for (int shift = 0; shift <= 63 && p < limit; shift += 7) {
+        uint64_t byte = static_cast<unsigned char>(*p++);
+        v |= (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return p;
+    }
+    throw std::runtime_error("corrupted block");
+}
+
+std::string compressBlock(const std::string &raw, blockCodec codec) {
+    if (codec != CODEC_NONE) {
+        std::string res = lz::compress(raw, codec == CODEC_LZ_HIGH);
+        if (res.size() < raw.size() - raw.size() / 8) {
+            res += static_cast<char>(codec);
+            return res;
+        }
+    }
+    return raw + static_cast<char>(CODEC_NONE);
+}
+
+std::string uncompressBlock(std::string_view stored) {
+    if (stored.empty())
+        throw std::runtime_error("corrupted block");
+    uint8_t codec = stored.back();
+    if (codec == CODEC_NONE)
+        return std::string(stored.substr(0, stored.size() - 1));
+    std::string res;
+    if ((codec != CODEC_LZ && codec != CODEC_LZ_HIGH) || !lz::uncompress(stored.data(), stored.size() - 1, res))
+        throw std::runtime_error("corrupted block");
+    return res;
+}
+
+blockBuilder::blockBuilder(uint32_t restartInterval) : restartInterval(restartInterval ? restartInterval : 1) {}
+
+void blockBuilder::add(uint64_t key, const std::string &val) {
+    uint64_t delta = key - last;
+    if (counter % restartInterval == 0) { // restart 点存完整的 key
+        restarts.push_back(buf.size());
+        delta   = key;
+        counter = 0;
+    }
+    putVarint(buf, delta);
+    putVarint(buf, val.length());
+    buf += val;
+    last = key;
+    counter++;
+}
+
+std::string blockBuilder::finish() {
+    for (uint32_t off : restarts)
+        buf.append(reinterpret_cast<const char *>(&off), 4);
+    uint32_t n = restarts.size();
+    buf.append(reinterpret_cast<const char *>(&n), 4);
+
+    std::string res;
+    res.swap(buf);
+    restarts.clear();
+    counter = 0;
+    last    = 0;
+    return res;
+}
+
+std::string uncompressBlock(std::string &&stored) {
+    if (!stored.empty() && stored.back() == CODEC_NONE) { // 没压缩的块去掉末尾的 codec 就行，不用再拷贝
+        stored.pop_back();
+        return std::move(stored);
+    }
+    return uncompressBlock(std::string_view(stored));
+}
+
+blockIterator::blockIterator(std::shared_ptr<const std::string> data) :
+    blockIterator(std::string_view(*data), data) {}
+
+blockIterator::blockIterator(std::string_view s, std::shared_ptr<const void> owner) : owner(std::move(owner)) {
+    if (s.size() < 4)
+        throw std::runtime_error("corrupted block");
+    base = s.data();
+    memcpy(&restartNum, base + s.size() - 4, 4);
+    if (4ull * restartNum + 4 > s.size())
+        throw std::runtime_error("corrupted block");
+    limit = s.size() - 4 - 4 * restartNum;
+    seekToFirst();
+}
+
+uint32_t blockIterator::restartPoint(uint32_t i) const {
+    uint32_t off;
+    memcpy(&off, base + limit + 4 * i, 4);
+    return off;
+}
+
+void blockIterator::parse() {
+    cur = nxt;
+    if (cur >= limit)
+        return;
+    uint64_t prevKey = curKey;
+    if (nextRestart < restartNum && restartPoint(nextRestart) == cur) { // restart 点存的是完整的 key
+        prevKey = 0;
+        nextRestart++;
+    }
+    uint64_t delta, len;
+    const char *p = getVarint(base + cur, base + limit, delta);
+    p             = getVarint(p, base + limit, len);
+    if (len > static_cast<uint64_t>(base + limit - p))
+        throw std::runtime_error("corrupted block");
+    curKey = prevKey + delta;
+    val    = p;
+    valLen = len;
+    nxt    = p + len - base;
+}
+
+void blockIterator::seekToFirst() {
+    nxt         = 0;
+    nextRestart = 0;
+    parse();
+}
+
+void blockIterator::seek(uint64_t key) {
+    // 找最后一个 key <= 目标的 restart 点，再往后顺序扫描
+    uint32_t lo = 0, hi = restartNum;
+    while (lo + 1 < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        uint64_t k;
+        getVarint(base + restartPoint(mid), base + limit, k);
+        if (k <= key)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    nxt         = restartNum ? restartPoint(lo) : limit;
+    nextRestart = lo;
+    parse();
+    while (valid() && curKey < key)
+        next();
+}
+
+void blockIterator::next() {
+    parse();
+}
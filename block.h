@@ -0,0 +1,97 @@
+#pragma once
+
+#ifndef LSM_KV_BLOCK_H
+#define LSM_KV_BLOCK_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/**
+ * 数据块格式（block-based sstable 用）:
+ *   entry * n | uint32_t restart[m] | uint32_t m
+ *   entry = varint keyDelta | varint len | char val[len]
+ * keyDelta 是与上一个 key 的差；restart 点上的 entry 存完整的 key（与 0 的差），
+ * restart 数组记录这些 entry 的偏移，查找时先在 restart 点上二分再顺序扫描。
+ */
+/* 数据块落盘时的压缩算法，写在块末尾的 1 字节里 */
+enum blockCodec : uint8_t {
+    CODEC_NONE    = 0,
+    CODEC_LZ      = 1, // lz::compress 快速模式
+    CODEC_LZ_HIGH = 2  // lz::compress 高压缩比模式，解压与 CODEC_LZ 相同
+};
+
+/* 压缩后的数据 | codec；压缩省不到 1/8 时存原文 */
+std::string compressBlock(const std::string &raw, blockCodec codec);
+std::string uncompressBlock(std::string_view stored);
+std::string uncompressBlock(std::string &&stored); // 没压缩时直接取用 stored 的缓冲
+
+class blockBuilder {
+private:
+    std::string buf;
+    std::vector<uint32_t> restarts;
+    uint32_t restartInterval;
+    uint32_t counter = 0; // 距上一个 restart 点的 entry 数
+    uint64_t last    = 0;
+
+public:
+    explicit blockBuilder(uint32_t restartInterval = 16);
+
+    void add(uint64_t key, const std::string &val); // key 必须递增
+    std::string finish();                            // 返回整个块并清空
+
+    size_t size() const { // 当前块 finish 之后的大小
+        return buf.size() + 4 * restarts.size() + 4;
+    }
+
+    bool empty() const {
+        return buf.empty();
+    }
+
+    uint64_t lastKey() const {
+        return last;
+    }
+};
+
+class blockIterator {
+private:
+    std::shared_ptr<const void> owner; // 让块的内存在迭代器用完之前不被释放
+    const char *base   = nullptr;
+    uint32_t limit       = 0; // entry 区的结尾，即 restart 数组的开头
+    uint32_t restartNum  = 0;
+    uint32_t nextRestart = 0; // 下一个还没经过的 restart 点
+
+    uint32_t cur = 0, nxt = 0; // 当前 entry 和下一个 entry 的偏移
+    uint64_t curKey = 0;
+    const char *val = nullptr;
+    uint32_t valLen = 0;
+
+    uint32_t restartPoint(uint32_t i) const;
+    void parse(); // 解析 nxt 处的 entry，成为当前 entry
+
+public:
+    blockIterator() {}
+
+    explicit blockIterator(std::shared_ptr<const std::string> data);
+    blockIterator(std::string_view data, std::shared_ptr<const void> owner); // data 由 owner 持有，比如 mmap 的文件
+
+    bool valid() const {
+        return cur < limit;
+    }
+
+    uint64_t key() const {
+        return curKey;
+    }
+
+    std::string_view value() const { // 指向块中的数据，块由迭代器持有
+        return std::string_view(val, valLen);
+    }
+
+    void seekToFirst();
+    void seek(uint64_t key); // 定位到第一个 >= key 的 entry
+    void next();
+};
+
+#endif // LSM_KV_BLOCK_H
@@ -0,0 +1,57 @@
+#include "blockcache.h"
+
+BlockCache::BlockCache(size_t capacity, bool strictCapacity) :
+    capacity(capacity),
+    shardCapacity(capacity / SHARDS),
+    strictCapacity(strictCapacity) {}
+
+BlockCache::Block BlockCache::lookup(uint64_t tableId, uint64_t blockNo) {
+    Key key{tableId, blockNo};
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.table.find(key);
+    if (it == shard.table.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second); // 移到队首
+    return it->second->second;
+}
+
+BlockCache::Block BlockCache::insert(uint64_t tableId, uint64_t blockNo, std::string data) {
+    Key key{tableId, blockNo};
+    Block block  = std::make_shared<const std::string>(std::move(data));
+    size_t size  = block->size();
+    Shard &shard = shardOf(key);
+    std::lock_guard<std::mutex> lock(shard.mtx);
+    auto it = shard.table.find(key);
+    if (it != shard.table.end())
+        return it->second->second; // 其他读者已经放进来了
+
+    // 从队尾开始淘汰，跳过仍被读者持有的块
+    for (auto cur = shard.lru.end(); shard.usage + size > shardCapacity && cur != shard.lru.begin();) {
+        --cur;
+        if (cur->second.use_count() > 1)
+            continue;
+        shard.usage -= cur->second->size();
+        shard.table.erase(cur->first);
+        cur = shard.lru.erase(cur);
+    }
+    if (shard.usage + size > shardCapacity && strictCapacity)
+        return block; // 放不下，不缓存
+
+    shard.lru.emplace_front(key, block);
+    shard.table[key] = shard.lru.begin();
+    shard.usage += size;
+    return block;
+}
+
+size_t BlockCache::getUsage() {
+    size_t res = 0;
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mtx);
+        res += shard.usage;
+    }
+    return res;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#ifndef LSM_KV_BLOCKCACHE_H
+#define LSM_KV_BLOCKCACHE_H
+
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+/**
+ * 分片的 sstable 数据块 LRU 缓存，按块的字节数计算占用.
+ *
+ * key 为 (table id, 块号)。table id 由 TableHandle 分配、不会重用，文件删除后用同一个名字重建也读不到旧块。
+ * 每个分片占 capacity / SHARDS 字节。还被读者持有的块不会被换出；strictCapacity 时放不下的块不进缓存
+ * （调用者照样拿到这个块），否则分片可以暂时超出，等这些块被放手。
+ */
+class BlockCache {
+public:
+    using Block = std::shared_ptr<const std::string>;
+
+    BlockCache(size_t capacity, bool strictCapacity = false);
+
+    Block lookup(uint64_t tableId, uint64_t blockNo); // 未命中返回 nullptr
+    Block insert(uint64_t tableId, uint64_t blockNo, std::string data);
+
+    uint64_t getHits() const {
+        return hits;
+    }
+
+    uint64_t getMisses() const {
+        return misses;
+    }
+
+    size_t getCapacity() const {
+        return capacity;
+    }
+
+    size_t getUsage();
+
+private:
+    struct Key {
+        uint64_t tableId, blockNo;
+
+        bool operator==(const Key &b) const {
+            return tableId == b.tableId && blockNo == b.blockNo;
+        }
+    };
+
+    /* blockNo 要在乘法之前混进去，shardOf 取的是高位，否则同一张表的块全落在一个分片里 */
+    struct KeyHash {
+        size_t operator()(const Key &k) const {
+            uint64_t h = (k.tableId * 0x9E3779B97F4A7C15ull + k.blockNo) * 0xBF58476D1CE4E5B9ull;
+            return h ^ (h >> 31);
+        }
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        size_t usage = 0;
+        std::list<std::pair<Key, Block>> lru; // 队首是最近使用的
+        std::unordered_map<Key, std::list<std::pair<Key, Block>>::iterator, KeyHash> table;
+    };
+
+    static const int SHARD_BITS = 4;
+    static const int SHARDS     = 1 << SHARD_BITS;
+
+    Shard &shardOf(const Key &key) {
+        return shards[KeyHash()(key) >> (64 - SHARD_BITS)];
+    }
+
+private:
+    size_t capacity;
+    size_t shardCapacity;
+    bool strictCapacity;
+    Shard shards[SHARDS];
+
+    std::atomic<uint64_t> hits{0};
+    std::atomic<uint64_t> misses{0};
+};
+
+#endif // LSM_KV_BLOCKCACHE_H
@@ -0,0 +1,130 @@
+#include "filter.h"
+
+#include <cstring>
+
+static const uint32_t LEVEL_BITS = 4; // 相邻两种桶宽相差的位数
+
+/* bloom 的 payload：numProbes | 位数组 */
+static void encodeBloom(const bloom &bf, std::string &dst) {
+    if (!bf.size())
+        return;
+    uint32_t numProbes = bf.getNumProbes();
+    dst.append(reinterpret_cast<const char *>(&numProbes), 4);
+    dst.append(bf.data(), bf.size());
+}
+
+static bool decodeBloom(bloom &bf, const char *src, size_t n) {
+    bf = bloom();
+    if (n == 0)
+        return true;
+    if (n < 4 || (n - 4) % 64)
+        return false;
+    uint32_t numProbes;
+    memcpy(&numProbes, src, 4);
+    bf.load(src + 4, n - 4, true, numProbes);
+    return true;
+}
+
+/* 桶宽为 shift 位时 key 所在桶在 bloom 中的编号 */
+static inline uint64_t bucketId(uint64_t key, uint32_t shift) {
+    return ((key >> shift) << LEVEL_BITS) | (shift / LEVEL_BITS);
+}
+
+tableFilter::tableFilter(const std::vector<uint64_t> &keys, filterPolicy policy, uint32_t bitsPerKey) :
+    policy(policy) {
+    if (!bitsPerKey)
+        return;
+    if (policy == FILTER_XOR) {
+        xf = xorFilter(keys);
+        return;
+    }
+    bf = bloom(keys.size(), bitsPerKey);
+    for (uint64_t key : keys)
+        bf.insert(key);
+}
+
+void tableFilter::encode(std::string &dst) const {
+    uint32_t head[2] = {policy, 0};
+    size_t start     = dst.size();
+    dst.append(reinterpret_cast<const char *>(head), 8);
+    if (policy == FILTER_XOR)
+        xf.encode(dst);
+    else
+        encodeBloom(bf, dst);
+    uint32_t bytes = dst.size() - start - 8;
+    memcpy(&dst[start + 4], &bytes, 4);
+}
+
+bool tableFilter::decode(uint32_t policy, const char *src, size_t n) {
+    bf = bloom();
+    xf = xorFilter();
+    if (policy == FILTER_XOR) {
+        this->policy = FILTER_XOR;
+        return n == 0 || xf.decode(src, n);
+    }
+    if (policy != FILTER_BLOOM)
+        return false;
+    this->policy = FILTER_BLOOM;
+    return decodeBloom(bf, src, n);
+}
+
+rangeFilter::rangeFilter(const std::vector<uint64_t> &keys, uint32_t bitsPerKey) {
+    if (!bitsPerKey || keys.empty())
+        return;
+    std::vector<uint32_t> shifts;
+    uint64_t total = 0, last = 0;
+    for (uint32_t shift = 64 - LEVEL_BITS; shift > 0; shift -= LEVEL_BITS) {
+        uint64_t buckets = 1;
+        for (size_t i = 1; i < keys.size(); ++i)
+            buckets += (keys[i] >> shift) != (keys[i - 1] >> shift);
+        if (buckets > last) {
+            shifts.push_back(shift);
+            levelMask |= 1u << (shift / LEVEL_BITS);
+            total += buckets;
+            last = buckets;
+        }
+        if (2 * buckets >= keys.size())
+            break;
+    }
+
+    bf = bloom(total, bitsPerKey);
+    for (uint32_t shift : shifts) {
+        for (size_t i = 0; i < keys.size(); ++i) {
+            if (i == 0 || (keys[i] >> shift) != (keys[i - 1] >> shift))
+                bf.insert(bucketId(keys[i], shift));
+        }
+    }
+}
+
+bool rangeFilter::mayContain(uint64_t lo, uint64_t hi) const {
+    for (uint32_t shift = LEVEL_BITS; shift < 64; shift += LEVEL_BITS) { // 从细到粗
+        if (!((levelMask >> (shift / LEVEL_BITS)) & 1) || (hi >> shift) - (lo >> shift) >= MAX_BUCKETS)
+            continue;
+        for (uint64_t b = lo >> shift; b <= (hi >> shift); ++b) {
+            if (bf.search(bucketId(b << shift, shift)))
+                return true;
+        }
+        return false;
+    }
+    return true;
+}
+
+void rangeFilter::encode(std::string &dst) const {
+    uint32_t bytes = bf.size() ? 8 + bf.size() : 0;
+    dst.append(reinterpret_cast<const char *>(&bytes), 4);
+    if (!bytes)
+        return;
+    dst.append(reinterpret_cast<const char *>(&levelMask), 4);
+    encodeBloom(bf, dst);
+}
+
+bool rangeFilter::decode(const char *src, size_t n) {
+    levelMask = 0;
+    bf        = bloom();
+    if (n == 0)
+        return true;
+    if (n < 8)
+        return false;
+    memcpy(&levelMask, src, 4);
+    return decodeBloom(bf, src + 4, n - 4);
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#ifndef LSM_KV_FILTER_H
+#define LSM_KV_FILTER_H
+
+#include "bloom.h"
+#include "xorfilter.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/* sstable 的 key 过滤器种类，写在文件头里 */
+enum filterPolicy : uint8_t {
+    FILTER_BLOOM = 0, // blocked bloom，大小按 bitsPerKey
+    FILTER_XOR   = 1  // binary fuse filter，每个 key 约 9 位，误判率约 0.4%，只能整体建成
+};
+
+/**
+ * 一个 sstable 的过滤器，对外只有 search 一种语义：返回 false 时 key 一定不在表中.
+ * 文件中的格式：
+ *   uint32_t policy | uint32_t bytes | char payload[bytes]
+ *   bloom 的 payload = uint32_t numProbes | 位数组；xor 的 payload 见 xorFilter
+ * 空的过滤器（bitsPerKey 为 0）不排除任何 key。
+ */
+class tableFilter {
+private:
+    filterPolicy policy = FILTER_BLOOM;
+    bloom bf;
+    xorFilter xf;
+
+public:
+    tableFilter() {}
+
+    tableFilter(const std::vector<uint64_t> &keys, filterPolicy policy, uint32_t bitsPerKey);
+
+    tableFilter(const bloom &bf) : bf(bf) {} // legacy 文件只有 bloom
+
+    bool search(uint64_t key) const {
+        return policy == FILTER_XOR ? xf.search(key) : bf.search(key);
+    }
+
+    filterPolicy getPolicy() const {
+        return policy;
+    }
+
+    size_t size() const { // 过滤器本身占的字节数
+        return policy == FILTER_XOR ? xf.size() : bf.size();
+    }
+
+    uint32_t getNumProbes() const { // 一次查询的探测次数
+        return policy == FILTER_XOR ? 3 : bf.getNumProbes();
+    }
+
+    void encode(std::string &dst) const;
+    bool decode(uint32_t policy, const char *src, size_t n); // payload 部分，数据不对返回 false
+};
+
+/**
+ * 区间过滤器：把 key 按高位分桶，对 4、8、...、60 位的若干种桶宽各记下哪些桶里有 key，
+ * 所有桶宽的桶放在同一个 bloom 里（桶号的低 4 位是桶宽 / 4）.
+ * 建表时从最粗的桶宽往细走，只保留比上一种分出更多桶的，桶数达到 key 数的一半就停，
+ * 这样稠密的表只有几个粗桶宽，稀疏的表也最多多出约一倍 key 数的桶。
+ * 查询 [lo, hi] 时用覆盖桶数不超过 MAX_BUCKETS 的最细桶宽，逐个检查；没有合适的桶宽就不排除。
+ * 格式：uint32_t levelMask | uint32_t numProbes | 位数组，levelMask 的第 i 位表示保留了 4*i 位的桶宽。
+ */
+class rangeFilter {
+private:
+    uint32_t levelMask = 0;
+    bloom bf;
+
+public:
+    static const uint64_t MAX_BUCKETS = 16;
+
+    rangeFilter() {}
+
+    rangeFilter(const std::vector<uint64_t> &keys, uint32_t bitsPerKey); // keys 升序
+
+    bool mayContain(uint64_t lo, uint64_t hi) const; // [lo, hi] 中可能有 key
+
+    size_t size() const {
+        return bf.size();
+    }
+
+    void encode(std::string &dst) const; // uint32_t bytes | payload
+    bool decode(const char *src, size_t n);
+};
+
+#endif // LSM_KV_FILTER_H
@@ -1,78 +1,52 @@
 #include "kvstore.h"
 
 #include "embedding.h"
+#include "manifest.h"
 #include "skiplist.h"
 #include "sstable.h"
 #include "utils.h"
 
 #include <algorithm>
+#include <chrono>
+#include <climits>
 #include <cstdlib>
+#include <functional>
 #include <iostream>
-#include <queue>
+#include <memory>
 #include <set>
+#include <stdexcept>
 #include <string>
+#include <tuple>
 #include <utility>
 #include <thread>
-#include <unordered_map>
 
 static const std::string DEL = "~DELETED~";
 const uint32_t MAXSIZE       = 2 * 1024 * 1024;
 
-struct poi {
-    int sstableId; // vector中第几个sstable
-    int pos;       // 该sstable的第几个key-offset
-    uint64_t time;
-    Index index;
-};
-
-struct cmpPoi {
-    bool operator()(const poi &a, const poi &b) {
-        if (a.index.key == b.index.key)
-            return a.time < b.time;
-        return a.index.key > b.index.key;
-    }
-};
-
 bool KVStore::sstable_num_out_of_limit(int level) {
-    int limit = 1 << (level + 1); // 2^(k+1)
-    return sstableIndex[level].size() > limit;
+    size_t limit = size_t(1) << (level + 1); // 2^(k+1)
+    return current->levels[level].size() > limit;
 }
 
-void KVStore::merge_sstables(std::vector<sstablehead>& ssts, std::map<uint64_t, std::string>& pairs) {
-    size_t sst_num = ssts.size();
-    unsigned int thread_num = std::min<unsigned int>(std::thread::hardware_concurrency(), sst_num);
-    std::vector<std::unordered_map<uint64_t, std::string>> partial_pairs(thread_num);
-    std::vector<std::thread> threads;
-
-    /* 线程各自写入自己的 partial_pairs */
-    auto worker = [&](size_t tid) {
-        for (size_t i = tid; i < sst_num; i += thread_num) {
-            sstable ss(ssts[i]);
-            const int cnt = ss.getCnt();
-            for (int j = 0; j < cnt; ++j) {
-                auto&& key = ss.getKey(j);
-                partial_pairs[tid][key] = ss.getData(j);
-            }
-        }
-    };
-
-    /* 创建并执行线程 */
-    for (unsigned t = 0; t < thread_num; ++t) {
-        threads.emplace_back(worker, t);
-    }
-    for (auto& th : threads) th.join();
-
-    /* 合并结果（按线程顺序保证正确性）*/
-    for (auto& pmap : partial_pairs) {
-        for (auto&& [key, val] : pmap) {
-            pairs[key] = std::move(val);
-        }
-    }
-
-    /* 删除原来的 sstables */
-    for (auto&& sst : ssts) {
-        delsstable(sst.getFilename());
+/**
+ * 对 ssts 中 [lo, hi] 内的 key 做多路归并，每个 key 只把最新的版本按升序交给 emit.
+ * ssts 需按从旧到新排列；每个输入只占一个读缓冲，内存与合并的数据量无关。
+ */
+void KVStore::merge_sstables(
+    std::vector<sstablehead> &ssts,
+    uint64_t lo,
+    uint64_t hi,
+    const std::function<void(uint64_t, const std::string &)> &emit
+) {
+    std::vector<std::unique_ptr<InternalIterator>> iters;
+    for (auto it = ssts.rbegin(); it != ssts.rend(); ++it) { // MergingIterator 要从新到旧
+        if (it->getMaxV() < lo || it->getMinV() > hi)
+            continue;
+        iters.push_back(std::make_unique<sstableIterator>(*it, *asyncReader));
     }
+    MergingIterator merged(std::move(iters));
+    for (merged.seek(lo); merged.valid() && merged.key() <= hi; merged.next())
+        emit(merged.key(), std::string(merged.value()));
 }
 
 void KVStore::load_embedding_from_disk(const std::string &data_root) {
@@ -87,10 +61,23 @@ void KVStore::load_embedding_from_disk(const std::string &data_root) {
 //     hnsw.loadFile(data_root);
 // }
 
-KVStore::KVStore(const std::string &dir) :
-    KVStoreAPI(dir) // read from sstables
-{
+KVStore::KVStore(const std::string &dir, const KVStoreOptions &options) :
+    KVStoreAPI(dir), // read from sstables
+    options(options),
+    wal(dir + "/wal", options.walSyncMode, options.walSyncIntervalMs),
+    manifest(dir),
+    asyncReader(AsyncReader::create(options.asyncIoMode, options.asyncIoDepth, options.asyncIoThreads)),
+    tableCache(options.tableCacheCapacity, options.mmapReads),
+    blockCache(options.blockCacheCapacity, options.blockCacheStrictCapacity) {
     /* read k-value */
+    std::vector<FileMeta> metas;
+    bool hasManifest = manifest.load(metas, lastTime);
+    std::set<std::pair<uint32_t, std::string>> live; // MANIFEST 中的 (level, 文件名)
+    for (FileMeta &f : metas)
+        live.emplace(f.level, f.filename.substr(f.filename.rfind('/') + 1));
+
+    std::vector<sstablehead> heads[MAX_LEVELS];
+    int totalLevel;
     for (totalLevel = 0;; ++totalLevel) {
         std::string path = dir + "/level-" + std::to_string(totalLevel) + "/";
         std::vector<std::string> files;
@@ -99,63 +86,248 @@ KVStore::KVStore(const std::string &dir) :
             break; // stop read
         }
         int nums = utils::scanDir(path, files);
-        sstablehead cur;
-        for (int i = 0; i < nums; ++i) {       // 读每一个文件头
+        for (int i = 0; i < nums; ++i) {
             std::string url = path + files[i]; // url, 每一个文件名
-            cur.loadFileHead(url.data());
-            sstableIndex[totalLevel].push_back(cur);
-            TIME = std::max(TIME, cur.getTime()); // 更新时间戳
+            if (!hasManifest) {                // 旧版本的库没有 MANIFEST，只能逐个读文件头
+                sstablehead cur;
+                cur.setFilename(url);
+                heads[totalLevel].push_back(cur);
+            } else if (!live.count({totalLevel, files[i]})) {
+                // 崩溃前没来得及记入 MANIFEST 的输出，或已经合并掉但没来得及删除的输入
+                utils::rmfile(url.data());
+            }
         }
     }
+    for (FileMeta &f : metas) {
+        sstablehead cur;
+        f.apply(cur);
+        heads[f.level].push_back(cur);
+        totalLevel = std::max<int>(totalLevel, f.level);
+    }
+    load_heads(heads, totalLevel, hasManifest);
+
+    for (int level = 0; level <= totalLevel; ++level) {
+        for (sstablehead &it : heads[level])
+            lastTime = std::max(lastTime, it.getTime()); // 更新时间戳
+    }
+    std::sort(heads[0].begin(), heads[0].end()); // level-0 按时间戳从旧到新
+    if (!hasManifest) { // 第一次打开，为已有的文件建立 MANIFEST
+        VersionEdit edit;
+        edit.lastTime = lastTime;
+        for (int level = 0; level <= totalLevel; ++level) {
+            for (sstablehead &it : heads[level])
+                edit.added.emplace_back(level, it);
+        }
+        manifest.logEdit(edit);
+    }
+
+    auto version = std::make_shared<Version>();
+    for (int level = 0; level <= totalLevel; ++level) {
+        for (sstablehead &it : heads[level])
+            version->add(level, std::make_shared<TableMeta>(std::move(it)));
+        if (level)
+            version->sortLevel(level);
+    }
+    version->totalLevel = totalLevel; // 空的层目录也算
+    current             = version;
+
+    /* 恢复上次未落盘的 memtable */
+    replay_wal();
+
+    l0Files   = current->levels[0].size();
+    flusher   = std::thread(&KVStore::flush_loop, this);
+    compactor = std::thread(&KVStore::compaction_loop, this);
+}
+
+/**
+ * 多线程读取所有 sstable 的 bloom 和 index.
+ * 有 MANIFEST 时元数据已经填好，只读 bloom 和 index；否则连文件头一起读。
+ */
+void KVStore::load_heads(std::vector<sstablehead> *levels, int totalLevel, bool hasMeta) {
+    std::vector<sstablehead *> heads;
+    for (int level = 0; level <= totalLevel; ++level) {
+        for (sstablehead &it : levels[level])
+            heads.push_back(&it);
+    }
+
+    std::atomic<size_t> next(0);
+    auto worker = [&]() {
+        for (size_t i; (i = next++) < heads.size();) {
+            if (hasMeta) {
+                heads[i]->loadFilterAndIndex();
+            } else {
+                std::string url = heads[i]->getFilename();
+                heads[i]->loadFileHead(url.data());
+            }
+        }
+    };
+
+    size_t threadNum = std::min<size_t>(heads.size(), std::max<uint32_t>(options.openThreads, 1));
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < threadNum; ++t) {
+        threads.emplace_back(worker);
+    }
+    worker();
+    for (auto &th : threads) th.join();
 }
 
 KVStore::~KVStore() {
+    /* 等后台把 immutable memtable 刷完，正在进行的合并做完后停止 */
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopFlush = true;
+    }
+    flushCv.notify_all();
+    flusher.join();
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopCompact = true;
+    }
+    compactCv.notify_all();
+    compactor.join();
+
     /* put k-vec */
     kvecTable.putFile("./data/embedding_data");
 
-    /* put k-value */
-    sstable ss(s);
-    if (!ss.getCnt())
-        return; // empty sstable
-    std::string path = std::string("./data/level-0/");
+    /* memtable 已经在 WAL 中，下次启动时重放，这里不再 flush + compaction */
+    try {
+        wal.sync();
+    } catch (const std::runtime_error &) {
+        // 析构不能抛异常，失败之前的写入已经报过错
+    }
+}
+
+/**
+ * 刚写入的一条是否让 memtable 超过了 2MB，写入之后才判断，最多超出一条记录.
+ * oldLen 是 upsert 返回的旧 value 长度（新 key 为 -1）：不变长的覆盖不会让 memtable 变大，不触发切换。
+ */
+bool KVStore::memtable_out_of_limit(int64_t oldLen, uint32_t valLen) {
+    if (s->getMemoryUsage() > 8 * MAXSIZE)
+        return true; // 反复变长的更新会在 Arena 里留下旧的 value，实际内存太大也要落盘
+    if (oldLen >= 0 && valLen <= oldLen)
+        return false;
+    return s->getBytes() + 10240 + 32 > MAXSIZE; // 超过 2MB
+}
+
+/**
+ * 将 mem 写成 level-0 的 sstable 并加入缓存，合并由后台线程负责.
+ * 写文件时不持锁，读者在此期间仍然可以从 imm 中读到这些数据。
+ */
+void KVStore::flush_memtable(skiplist *mem) {
+    sstable ss(mem, ++lastTime);
+    ss.setBlockSize(options.blockSize);
+    ss.setCodec(codec_for_level(0, false));
+    ss.setBitsPerKey(options.bloomBitsPerKey);
+    ss.setFilterPolicy(filter_for_level(0));
+    ss.setRangeBitsPerKey(options.rangeFilterBitsPerKey);
+    std::string url  = ss.getFilename();
+    std::string path = "./data/level-0";
     if (!utils::dirExists(path)) {
         utils::mkdir(path.data());
-        totalLevel = 0;
+        utils::syncDir("./data"); // 新目录的目录项也要落盘
+    }
+    ss.putFile(url.data()); // 加入磁盘并 fsync
+
+    VersionEdit edit;
+    edit.lastTime = ss.getTime();
+    edit.added.emplace_back(0, ss);
+    manifest.logEdit(edit); // 记入 MANIFEST 之后才算生效
+
+    std::lock_guard<std::mutex> lock(mtx);
+    addsstable(ss, 0);      // 加入当前 Version
+    compactCv.notify_one(); // 合并交给后台
+}
+
+/**
+ * 当前 memtable 写满：转为 immutable，交给后台线程落盘.
+ * 多个写者可能同时发现写满，只有第一个真正切换，其余的等到 s 已经换掉就直接返回。
+ */
+void KVStore::switch_memtable(skiplist *full) {
+    /* 上一个 imm 还没刷完，或者 level-0 文件数到了 stop 阈值，只能等 */
+    std::unique_lock<std::mutex> lock(mtx);
+    writeCv.wait(lock, [&] {
+        return s.get() != full || (imm == nullptr && current->levels[0].size() < options.l0StopTrigger);
+    });
+    if (s.get() != full)
+        return; // 别的写者已经换过了
+    {
+        std::unique_lock<std::shared_mutex> memLock(memMtx); // 等正在往 s 里写的写者写完
+        imm    = s;
+        immLog = wal.rotate();
+        s      = std::make_shared<skiplist>(0.5);
+    }
+    lock.unlock();
+    flushCv.notify_one();
+    writeCv.notify_all(); // 叫醒同样在等着切换 full 的写者
+
+    /* put k-vec */
+    kvecTable.putFile("./data/embedding_data");
+}
+
+void KVStore::flush_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        flushCv.wait(lock, [this] { return imm != nullptr || stopFlush; });
+        if (imm == nullptr)
+            break; // stopFlush
+        std::shared_ptr<skiplist> mem = imm;
+        uint64_t log                  = immLog;
+        lock.unlock();
+
+        flush_memtable(mem.get());
+        wal.removeUpTo(log); // sstable 已落盘，对应的日志可以删除
+
+        lock.lock();
+        {
+            std::unique_lock<std::shared_mutex> memLock(memMtx);
+            imm = nullptr; // 还在读它的读者用完之后才释放
+        }
+        writeCv.notify_all();
+    }
+}
+
+void KVStore::replay_wal() {
+    bool flushed = false;
+    wal.replay([&](uint64_t key, const std::string &val) {
+        int64_t oldLen = s->upsert(key, val, ++lastSeq);
+        if (memtable_out_of_limit(oldLen, val.length())) {
+            flush_memtable(s.get()); // 后台线程尚未启动，同步落盘
+            s->reset();
+            flushed = true;
+        }
+    });
+
+    /* 旧日志里有一部分已经进了 sstable，把剩下的重新记一份再删旧日志 */
+    if (flushed) {
+        uint64_t oldLog = wal.getLogNumber() - 1;
+        for (slnode *cur = s->getFirst(); cur->type != TAIL; cur = cur->nxt[0])
+            wal.append(cur->key, std::string(cur->value()));
+        wal.sync();
+        wal.removeUpTo(oldLog);
     }
-    ss.putFile(ss.getFilename().data());
-    compaction(); // 从0层开始尝试合并
 }
 
 /**
  * Insert/Update the key-value pair.
  * No return values for simplicity.
+ *
+ * 可以多线程同时调用，同一个 key 的写入由调用者保证不并发。
+ * 写 WAL 和写 memtable 都在 memMtx 的共享锁下，日志切换时不会有写者落在两个 memtable 之间；
+ * 写满之后才切换，切换完成之前几个写者同时写可能让 memtable 略微超过 2MB。
+ * 建快照时独占 memMtx，所以分到 seq 的写入在快照建好之前一定已经进了 memtable。
  */
 void KVStore::put(uint64_t key, const std::string &val) {
-    uint32_t nxtsize = s->getBytes();
-    std::string res  = s->search(key);
-    if (!res.length()) { // new add
-        nxtsize += 12 + val.length();
-    } else
-        nxtsize = nxtsize - res.length() + val.length(); // change string
-    if (nxtsize + 10240 + 32 <= MAXSIZE)
-        s->insert(key, val); // 小于等于（不超过） 2MB
-    else {
-        /* put k-vec */
-        kvecTable.putFile("./data/embedding_data");
-
-        /* put k-value */
-        sstable ss(s);
-        s->reset();
-        std::string url  = ss.getFilename();
-        std::string path = "./data/level-0";
-        if (!utils::dirExists(path)) {
-            utils::mkdir(path.data());
-            totalLevel = 0;
-        }
-        addsstable(ss, 0);      // 加入缓存
-        ss.putFile(url.data()); // 加入磁盘
-        compaction();
-        s->insert(key, val);
+    if (l0Files >= options.l0SlowdownTrigger)
+        delay_write(12 + val.length());
+    std::shared_lock<std::shared_mutex> memLock(memMtx);
+    uint64_t seq = ++lastSeq;
+    wal.append(key, val);
+    skiplist *mem = s.get();
+    // 读 newestSnapshot 和建快照被 memMtx 隔开
+    int64_t oldLen = mem->upsert(key, val, seq, newestSnapshot.load(std::memory_order_relaxed));
+    if (memtable_out_of_limit(oldLen, val.length())) { // 超过 2MB，交给后台落盘
+        memLock.unlock();
+        switch_memtable(mem);
     }
 }
 
@@ -168,54 +340,212 @@ void KVStore::put(uint64_t key, const std::vector<float> &vec) {
  * Returns the (string) value of the given key.
  * An empty string indicates not found.
  */
-std::string KVStore::get(uint64_t key) //
-{
-    uint64_t time = 0;
-    int goalOffset;
-    uint32_t goalLen;
-    std::string goalUrl;
-    std::string res = s->search(key);
+std::string KVStore::get(uint64_t key) {
+    return std::string(getPinned(key).view());
+}
+
+std::string KVStore::get(uint64_t key, const Snapshot &snapshot) {
+    return std::string(getPinned(key, snapshot).view());
+}
+
+PinnedValue KVStore::getPinned(uint64_t key) {
+    /* 在 memtable 中找，没找到就把 imm 和当前 Version 一起拿走，之后不用再持锁 */
+    std::string res;
+    std::shared_ptr<skiplist> immMem;
+    std::shared_ptr<const Version> pinned;
+    {
+        std::shared_lock<std::shared_mutex> memLock(memMtx);
+        res = s->search(key);
+        if (!res.length()) {
+            immMem  = imm;
+            pinned  = current;
+        }
+    }
 
     /* 在memtable中找到, 或者是deleted，说明最近被删除过 */
-    if (res.length()) { 
-        if (res == DEL)
-            return "";
-        return res;
+    if (res.length())
+        return res == DEL ? PinnedValue() : PinnedValue(std::move(res));
+
+    PinnedValue val = get_older(key, immMem.get(), *pinned);
+    return val.view() == DEL ? PinnedValue() : val;
+}
+
+/* 在快照的 memtable 中只看 seq 及之前的版本，imm 和 Version 都是建快照时的，不会再变 */
+PinnedValue KVStore::getPinned(uint64_t key, const Snapshot &snapshot) {
+    std::string res = snapshot.mem->search(key, snapshot.seq);
+    if (res.length())
+        return res == DEL ? PinnedValue() : PinnedValue(std::move(res));
+    PinnedValue val = get_older(key, snapshot.imm.get(), *snapshot.version);
+    return val.view() == DEL ? PinnedValue() : val;
+}
+
+/**
+ * 在 memtable 之下按从新到旧查找 key，返回找到的原始 value（可能是删除标记），没找到返回空的.
+ * immMem 和 version 由调用者拿住，这里不持锁。sstable 中的 value 直接指向所在的块。
+ */
+PinnedValue KVStore::get_older(uint64_t key, skiplist *immMem, const Version &version) {
+    /* 在正在落盘的 immutable memtable 中寻找 */
+    if (immMem != nullptr) {
+        std::string res = immMem->search(key);
+        if (res.length())
+            return PinnedValue(std::move(res));
     }
 
-    /* 在sstable中寻找 */
-    for (int level = 0; level <= totalLevel; ++level) {
-        for (sstablehead& it : sstableIndex[level]) {
-            if (key < it.getMinV() || key > it.getMaxV())
-                continue;
+    /* 在sstable中按从新到旧寻找；level-0 的 sstable 可能相交，全部检查，其余层二分后至多一个候选 */
+    for (int level = 0; level <= version.totalLevel; ++level) {
+        const std::vector<TableRef> &ssts = version.levels[level];
+        int lo = 0, hi = ssts.size();
+        if (level) {
+            lo = version.findTable(level, key);
+            hi = std::min(lo + 1, hi);
+        }
+        for (int i = hi - 1; i >= lo; --i) {
+            const TableMeta &it = *ssts[i];
+            uint64_t offset;
             uint32_t len;
-            int offset = it.searchOffset(key, len);
-            if (offset == -1) {
-                if (!level)
-                    continue;
-                else
-                    break;
-            }
-            // sstable ss;
-            // ss.loadFile(it.getFilename().data());
-            if (it.getTime() > time) { // find the latest head
-                time       = it.getTime();
-                goalUrl    = it.getFilename();
-                goalOffset = offset + 32 + 10240 + 12 * it.getCnt();
-                goalLen    = len;
+            locateResult type = it.locate(key, offset, len);
+            if (type == NOT_FOUND)
+                continue;
+            // 被合并掉的文件要等持有这个 Version 的读者都放手才删除，这里总能打开
+            std::shared_ptr<TableHandle> table = tableCache.get(it.getFilename());
+            if (type == FOUND_VALUE) // legacy 的 index 是精确的，更旧的不用看了
+                return PinnedValue(read_value(*table, offset, len));
+            std::vector<BlockRead> reads = {{table, offset, len}};
+            read_blocks(reads);
+            blockIterator block(reads[0].data, reads[0].pin);
+            block.seek(key);
+            if (block.valid() && block.key() == key)
+                return PinnedValue(block.value(), std::move(reads[0].pin));
+            it.getStats()->falsePositives.fetch_add(1, std::memory_order_relaxed); // bloom 误判
+        }
+    }
+    return PinnedValue(); // not found a sstable
+}
+
+/**
+ * 一次查一批 key.
+ * key 排好序去重之后逐层往下：memtable 只加一次锁；每个 sstable 对整批还没找到的 key 查一遍过滤器，
+ * 要读的数据块先查 block cache，没命中的合成尽量少的读请求。level >= 1 按 key 顺序把批次切给各个文件，
+ * 整层的读一起交给 asyncReader；level-0 的文件可能相交，要按从新到旧一个一个查。
+ */
+std::vector<std::string> KVStore::multiGet(const std::vector<uint64_t> &keys) {
+    std::vector<uint64_t> sorted(keys);
+    std::sort(sorted.begin(), sorted.end());
+    sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+    std::vector<std::string> found(sorted.size()); // 找到的原始 value，可能是删除标记
+    std::vector<size_t> pending, rest;             // 还没找到的 key 在 sorted 中的下标，递增
+    std::shared_ptr<skiplist> immMem;
+    std::shared_ptr<const Version> pinned;
+    {
+        std::shared_lock<std::shared_mutex> memLock(memMtx);
+        for (size_t i = 0; i < sorted.size(); ++i) {
+            found[i] = s->search(sorted[i]);
+            if (!found[i].length())
+                pending.push_back(i);
+        }
+        immMem = imm;
+        pinned = current;
+    }
+    if (immMem != nullptr) {
+        for (size_t i : pending) {
+            found[i] = immMem->search(sorted[i]);
+            if (!found[i].length())
+                rest.push_back(i);
+        }
+        pending.swap(rest);
+    }
+
+    for (int level = 0; level <= pinned->totalLevel && !pending.empty(); ++level) {
+        const std::vector<TableRef> &ssts = pinned->levels[level];
+        if (level == 0) { // 从新到旧，每个文件查整批
+            for (int i = ssts.size() - 1; i >= 0 && !pending.empty(); --i) {
+                rest.clear();
+                multiget_tables({{ssts[i].get(), pending}}, sorted, found, rest);
+                pending.swap(rest);
             }
+            continue;
+        }
+        rest.clear();
+        std::vector<TableBatch> work;
+        size_t p = 0;
+        while (p < pending.size()) {
+            int t = pinned->findTable(level, sorted[pending[p]]);
+            if (size_t(t) == ssts.size()) // 比这一层所有的 key 都大
+                break;
+            TableBatch &w = work.emplace_back(TableBatch{ssts[t].get(), {}});
+            for (; p < pending.size() && sorted[pending[p]] <= ssts[t]->getMaxV(); ++p)
+                w.batch.push_back(pending[p]);
         }
-        if (time)
-            break; // only a test for found
-    }
-    if (!goalUrl.length())
-        return ""; // not found a sstable
-    res = fetchString(goalUrl, goalOffset, goalLen);
-    if (res == DEL)
-        return "";
+        multiget_tables(work, sorted, found, rest);
+        rest.insert(rest.end(), pending.begin() + p, pending.end());
+        pending.swap(rest);
+    }
+
+    std::vector<std::string> res;
+    res.reserve(keys.size());
+    for (uint64_t key : keys) {
+        const std::string &val = found[std::lower_bound(sorted.begin(), sorted.end(), key) - sorted.begin()];
+        res.push_back(val == DEL ? "" : val);
+    }
     return res;
 }
 
+/**
+ * 在 work 中的每个 sstable 里查它的那批 key，找到的写进 found，没找到的按 work 的顺序追加到 rest.
+ * 过滤器说可能有的 key 所在的数据块，所有文件的一起读。
+ */
+void KVStore::multiget_tables(
+    const std::vector<TableBatch> &work,
+    const std::vector<uint64_t> &keys,
+    std::vector<std::string> &found,
+    std::vector<size_t> &rest
+) {
+    std::vector<std::shared_ptr<TableHandle>> handles(work.size()); // 读完之前不能关闭
+    std::vector<BlockRead> reads;                                    // 同一个文件的偏移递增且不重复
+    std::vector<std::tuple<size_t, size_t, const TableMeta *>> probes; // (key 的下标, 所在数据块在 reads 中的下标, 文件)
+    for (size_t w = 0; w < work.size(); ++w) {
+        const TableMeta &table = *work[w].table;
+        for (size_t i : work[w].batch) {
+            uint64_t offset;
+            uint32_t len;
+            locateResult type = table.locate(keys[i], offset, len);
+            if (type == NOT_FOUND)
+                continue;
+            if (handles[w] == nullptr)
+                handles[w] = tableCache.get(table.getFilename());
+            if (type == FOUND_VALUE) { // legacy 的 index 是精确的
+                found[i] = read_value(*handles[w], offset, len);
+                continue;
+            }
+            if (reads.empty() || reads.back().table != handles[w] || reads.back().offset != offset)
+                reads.push_back({handles[w], offset, len});
+            probes.emplace_back(i, reads.size() - 1, &table);
+        }
+    }
+
+    read_blocks(reads);
+    blockIterator block;
+    size_t cur = reads.size();
+    for (auto [i, b, table] : probes) {
+        if (b != cur) { // 同一个块里的几个 key 只解析一次
+            block = blockIterator(reads[b].data, reads[b].pin);
+            cur   = b;
+        }
+        block.seek(keys[i]);
+        if (block.valid() && block.key() == keys[i])
+            found[i] = block.value();
+        else
+            table->getStats()->falsePositives.fetch_add(1, std::memory_order_relaxed); // bloom 误判
+    }
+    for (const TableBatch &w : work) {
+        for (size_t i : w.batch) {
+            if (!found[i].length())
+                rest.push_back(i);
+        }
+    }
+}
+
 /**
  * Delete the given key-value pair if it exists.
  * Returns false iff the key is not found.
@@ -242,9 +572,23 @@ bool KVStore::del(uint64_t key) {
  * including memtable and all sstables files.
  */
 void KVStore::reset() {
-    s->reset(); // 先清空memtable
+    std::unique_lock<std::mutex> lock(mtx);
+    writeCv.wait(lock, [this] { return imm == nullptr && !compacting; }); // 等后台落盘、合并结束
+
+    /* 不能有并发的读：直接删掉所有文件，不等持有旧 Version 的读者 */
+    std::shared_ptr<const Version> old;
+    {
+        std::unique_lock<std::shared_mutex> memLock(memMtx);
+        s       = std::make_shared<skiplist>(0.5); // 先清空memtable，还没释放的快照继续拿着旧的
+        old     = current;
+        current = std::make_shared<Version>();
+    }
+    retired.clear();
+    wal.reset();
+    manifest.reset(); // 先清空 MANIFEST，再删文件
+    tableCache.clear();
     std::vector<std::string> files;
-    for (int level = 0; level <= totalLevel; ++level) { // 依层清空每一层的sstables
+    for (int level = 0; level <= old->totalLevel; ++level) { // 依层清空每一层的sstables
         std::string path = std::string("./data/level-") + std::to_string(level);
         int size         = utils::scanDir(path, files);
         for (int i = 0; i < size; ++i) {
@@ -252,9 +596,9 @@ void KVStore::reset() {
             utils::rmfile(file.data());
         }
         utils::rmdir(path.data());
-        sstableIndex[level].clear();
     }
-    totalLevel = -1;
+    l0Files = 0;
+    std::fill(std::begin(compactPointer), std::end(compactPointer), 0);
 
     /* 清空 kvtable*/
     kvecTable.reset("./data/embedding_data");
@@ -265,195 +609,388 @@ void KVStore::reset() {
  * keys in the list should be in an ascending order.
  * An empty string indicates not found.
  */
+void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) {
+    Iterator it = newIterator(nullptr, key2);
+    for (it.seek(key1); it.valid(); it.next())
+        list.emplace_back(it.key(), it.value());
+}
 
-struct myPair {
-    uint64_t key, time;
-    int id, index;
-    std::string filename;
+void KVStore::scan(
+    uint64_t key1,
+    uint64_t key2,
+    std::list<std::pair<uint64_t, std::string>> &list,
+    const Snapshot &snapshot
+) {
+    // 调用期间调用者拿着快照，迭代器不用再持有它
+    Iterator it = newIterator(std::shared_ptr<const Snapshot>(std::shared_ptr<const Snapshot>(), &snapshot), key2);
+    for (it.seek(key1); it.valid(); it.next())
+        list.emplace_back(it.key(), it.value());
+}
 
-    myPair(uint64_t key, uint64_t time, int index, int id,
-           std::string file) { // construct function
-        this->time     = time;
-        this->key      = key;
-        this->id       = id;
-        this->index    = index;
-        this->filename = file;
-    }
-};
+/**
+ * 经过 block cache 读：block-based 读整个（解压后的）数据块，legacy 读单个 value.
+ * 数据块没命中时经过预读缓冲，顺着往后扫时一次读一大段。
+ */
+std::unique_ptr<InternalIterator> KVStore::table_iterator(const TableMeta &table) {
+    std::shared_ptr<TableHandle> handle = tableCache.get(table.getFilename());
+    bool blockBased                     = table.isBlockBased();
+    auto readahead = std::make_shared<ReadaheadReader>(handle, options.scanReadaheadInitial, options.scanReadaheadMax);
+    auto fetch     = [this, handle, blockBased, readahead](uint64_t offset, uint32_t len) -> BlockCache::Block {
+        if (blockBased)
+            return read_block(*handle, offset, len, readahead.get());
+        return std::make_shared<const std::string>(read_value(*handle, offset, len));
+    };
+    return std::make_unique<sstableIterator>(table, fetch);
+}
 
-struct cmp {
-    bool operator()(myPair &a, myPair &b) {
-        if (a.key == b.key)
-            return a.time < b.time;
-        return a.key > b.key;
+/**
+ * 按从新到旧的顺序为快照中的每个数据源建一个迭代器再归并：memtable、imm、level-0 每个文件各一个，
+ * level >= 1 每层一个、用到哪个文件才打开。
+ */
+KVStore::Iterator KVStore::newIterator(std::shared_ptr<const Snapshot> snapshot, uint64_t upper) {
+    if (snapshot == nullptr)
+        snapshot = getSnapshot();
+    std::vector<std::unique_ptr<InternalIterator>> children;
+    children.push_back(std::make_unique<MemtableIterator>(snapshot->mem.get(), snapshot->seq));
+    if (snapshot->imm != nullptr)
+        children.push_back(std::make_unique<MemtableIterator>(snapshot->imm.get(), snapshot->seq));
+    const Version &version = *snapshot->version;
+    auto open              = [this](const TableMeta &table) { return table_iterator(table); };
+    for (int level = 0; level <= version.totalLevel; ++level) {
+        const std::vector<TableRef> &ssts = version.levels[level];
+        if (level == 0) { // level-0 的文件可能相交，从新到旧各自一个
+            for (auto it = ssts.rbegin(); it != ssts.rend(); ++it)
+                children.push_back(std::make_unique<LevelIterator>(&*it, 1, upper, open));
+        } else if (!ssts.empty()) {
+            children.push_back(std::make_unique<LevelIterator>(ssts.data(), ssts.size(), upper, open));
+        }
     }
-};
+    return Iterator(std::move(snapshot), std::make_unique<MergingIterator>(std::move(children)), upper);
+}
 
-void KVStore::scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) {
-    std::vector<std::pair<uint64_t, std::string>> mem;
-    // std::set<myPair> heap; // 维护一个指针最小堆
-    std::priority_queue<myPair, std::vector<myPair>, cmp> heap;
-    // std::vector<sstable> ssts;
-    std::vector<sstablehead> sshs;
-    s->scan(key1, key2, mem);   // add in mem
-    std::vector<int> head, end; // [head, end)
-    int cnt = 0;
-    if (mem.size())
-        heap.push(myPair(mem[0].first, INF, 0, -1, "qwq"));
-    for (int level = 0; level <= totalLevel; ++level) {
-        for (sstablehead it : sstableIndex[level]) {
-            if (key1 > it.getMaxV() || key2 < it.getMinV())
-                continue; // 无交集
-            int hIndex = it.lowerBound(key1);
-            int tIndex = it.lowerBound(key2);
-            if (hIndex < it.getCnt()) { // 此sstable可用
-                // sstable ss; // 读sstable
-                std::string url = it.getFilename();
-                // ss.loadFile(url.data());
-
-                heap.push(myPair(it.getKey(hIndex), it.getTime(), hIndex, cnt++, url));
-                head.push_back(hIndex);
-                if (it.search(key2) == tIndex)
-                    tIndex++; // tIndex为第一个不可的
-                end.push_back(tIndex);
-                // ssts.push_back(ss); // 加入ss
-                sshs.push_back(it);
-            }
-        }
+KVStore::Iterator::Iterator(
+    std::shared_ptr<const Snapshot> snapshot,
+    std::unique_ptr<MergingIterator> iter,
+    uint64_t upper
+) :
+    snapshot(std::move(snapshot)),
+    iter(std::move(iter)),
+    upper(upper) {}
+
+bool KVStore::Iterator::valid() const {
+    return iter->valid() && iter->key() <= upper;
+}
+
+uint64_t KVStore::Iterator::key() const {
+    return iter->key();
+}
+
+std::string_view KVStore::Iterator::value() const {
+    return iter->value();
+}
+
+void KVStore::Iterator::seek(uint64_t key) {
+    iter->seek(key);
+    skipDeleted();
+}
+
+void KVStore::Iterator::next() {
+    iter->next();
+    skipDeleted();
+}
+
+/* 最新的版本是删除标记的 key 整个跳过 */
+void KVStore::Iterator::skipDeleted() {
+    while (valid() && iter->value() == DEL)
+        iter->next();
+}
+
+/**
+ * 建一个快照：独占 memMtx 等正在写的写者写完，之后 lastSeq 及之前的写入都已经在 memtable 里.
+ * 从此写者覆盖这些 key 时保留旧版本；快照拿着的 Version 使合并掉的文件留到它释放。
+ */
+std::shared_ptr<const Snapshot> KVStore::getSnapshot() {
+    Snapshot *snapshot = new Snapshot();
+    {
+        std::unique_lock<std::shared_mutex> memLock(memMtx);
+        snapshot->seq     = lastSeq.load();
+        snapshot->mem     = s;
+        snapshot->imm     = imm;
+        snapshot->version = current;
+        std::lock_guard<std::mutex> snapLock(snapMtx);
+        snapshots.insert(snapshot->seq);
+        newestSnapshot.store(snapshot->seq); // seq 单调增加，新快照总是最新的
     }
-    uint64_t lastKey = INF; // only choose the latest key
-    while (!heap.empty()) { // 维护堆
-        myPair cur = heap.top();
-        heap.pop();
-        if (cur.id >= 0) { // from sst
-            if (cur.key != lastKey) {
-                lastKey         = cur.key;
-                uint32_t start  = sshs[cur.id].getOffset(cur.index - 1);
-                uint32_t len    = sshs[cur.id].getOffset(cur.index) - start;
-                uint32_t scnt   = sshs[cur.id].getCnt();
-                std::string res = fetchString(cur.filename, 10240 + 32 + scnt * 12 + start, len);
-                if (res.length() && res != DEL)
-                    list.emplace_back(cur.key, res);
-            }
-            if (cur.index + 1 < end[cur.id]) { // add next one to heap
-                heap.push(myPair(sshs[cur.id].getKey(cur.index + 1), cur.time, cur.index + 1, cur.id, cur.filename));
-            }
-        } else { // from mem
-            if (cur.key != lastKey) {
-                lastKey         = cur.key;
-                std::string res = mem[cur.index].second;
-                if (res.length() && res != DEL)
-                    list.emplace_back(cur.key, mem[cur.index].second);
-            }
-            if (cur.index < mem.size() - 1) {
-                heap.push(myPair(mem[cur.index + 1].first, cur.time, cur.index + 1, -1, cur.filename));
-            }
+    return std::shared_ptr<const Snapshot>(snapshot, [this](const Snapshot *snapshot) {
+        release_snapshot(snapshot->seq);
+        delete snapshot;
+    });
+}
+
+void KVStore::release_snapshot(uint64_t seq) {
+    std::lock_guard<std::mutex> snapLock(snapMtx);
+    snapshots.erase(snapshots.find(seq));
+    newestSnapshot.store(snapshots.empty() ? 0 : *snapshots.rbegin());
+}
+
+/**
+ * 选出最需要合并的层：分数为该层文件数 / 该层上限，只考虑超限的层。
+ * 没有需要合并的层时返回 -1。调用时需持有 mtx。
+ */
+int KVStore::pick_compaction_level() {
+    int best         = -1;
+    double bestScore = 0;
+    for (int level = 0; level <= current->totalLevel; ++level) {
+        if (!sstable_num_out_of_limit(level))
+            continue;
+        double score = (double)current->levels[level].size() / (1 << (level + 1));
+        if (score > bestScore) {
+            best      = level;
+            bestScore = score;
         }
     }
+    return best;
 }
 
-void KVStore::compaction() {
-    int curLevel = 0;
-    // TODO here
+/**
+ * 把 curLevel 的超限部分合并进 curLevel + 1.
+ * 进入和返回时都持有 lock；选文件和安装结果在锁内，读写文件在锁外，
+ * 所以合并期间 get/scan 仍然可以读旧的 sstable。
+ * 每个 key 只留最新的版本：更早的快照拿着旧 Version，输入文件要等它们释放之后才删除。
+ */
+void KVStore::compact_level(std::unique_lock<std::mutex> &lock, int curLevel) {
+    // 如果下一层的文件夹不存在，则创建
+    std::string path = std::string("./data/level-") + std::to_string(curLevel + 1);
+    if (!utils::dirExists(path)) {
+        utils::mkdir(path.data());
+        utils::syncDir("./data"); // 新目录的目录项也要落盘
+    }
 
-    while (sstable_num_out_of_limit(curLevel)) {
-        // 如果下一层的文件夹不存在，则创建
-        std::string path = std::string("./data/level-") + std::to_string(curLevel + 1);
-        if (!utils::dirExists(path)) {
-            utils::mkdir(path.data());
-        }
+    // 合并期间一直持有开始时的 Version，输入文件不会被删除
+    std::shared_ptr<const Version> base = current;
+
+    // level-0 取最旧的3个 sstable
+    // level-n 从 compactPointer 之后轮流取超出限制个数的相邻 sstable
+    std::vector<sstablehead> ssts;
+    int size = base->levels[curLevel].size();
+    int start = 0;
+    size -= (1 << (curLevel + 1));     // 多出来的 sstable 个数
+    size = (curLevel == 0) ? 3 : size; // level-0 取3个 sstable
+    if (curLevel) {
+        const std::vector<TableRef> &level = base->levels[curLevel];
+        while (start < int(level.size()) && level[start]->getMinV() <= compactPointer[curLevel])
+            start++;
+        if (start + size > int(level.size()))
+            start = 0; // 到末尾了就从头再来
+        compactPointer[curLevel] = level[start + size - 1]->getMaxV();
+    }
+    for (int i = start; i < start + size; ++i) {
+        ssts.push_back(*base->levels[curLevel][i]);
+    }
 
-        // level-0 取3个 sstable
-        // level-n 取超出限制的 sstable
-        std::vector<sstablehead> ssts;
-        int size = sstableIndex[curLevel].size();
-        size -= (1 << (curLevel + 1));     // 多出来的 sstable 个数
-        size = (curLevel == 0) ? 3 : size; // level-0 取3个 sstable
-        for (int i = 0; i < size; ++i) {
-            ssts.push_back(sstableIndex[curLevel][i]);
-        }
+    // 取 ssts 中的 key 区间
+    uint64_t minKey = INF, maxKey = 0;
+    for (sstablehead &it : ssts) {
+        minKey = std::min(minKey, it.getMinV());
+        maxKey = std::max(maxKey, it.getMaxV());
+    }
 
-        // 取 ssts 中的 key 区间
-        uint64_t minKey = INF, maxKey = 0;
-        for (sstablehead &it : ssts) {
-            minKey = std::min(minKey, it.getMinV());
-            maxKey = std::max(maxKey, it.getMaxV());
+    // 找出 level-(n+1) 中 key 值在区间内的 sstable
+    // 它们的 minV 作为子合并的分界点
+    std::vector<sstablehead> overlaps;
+    std::vector<uint64_t> bounds;
+    for (const TableRef &it : base->levels[curLevel + 1]) {
+        if (it->getMinV() <= maxKey && it->getMaxV() >= minKey) {
+            overlaps.push_back(*it);
+            if (it->getMinV() > minKey)
+                bounds.push_back(it->getMinV());
         }
+    }
 
-        // 找出 level-(n+1) 中 key 值在区间内的 sstable
-        for (sstablehead &it : sstableIndex[curLevel + 1]) {
-            if (it.getMinV() <= maxKey && it.getMaxV() >= minKey) {
-                ssts.push_back(it);
-            }
-        }
+    // 归并时同一个 key 以 ssts 中靠后的为准：
+    // level-n 一定比 level-(n+1) 新（合并产物的时间戳不能说明新旧），level-n 内部再按时间戳排序
+    std::sort(ssts.begin(), ssts.end());
+    ssts.insert(ssts.begin(), overlaps.begin(), overlaps.end());
+    uint64_t maxTime = 0;
+    for (sstablehead &it : ssts) {
+        maxTime = std::max(maxTime, it.getTime());
+    }
 
-        // 将 ssts 中的 sstable 按时间戳排序，时间戳小的在前
-        // 保证下一步中时间戳较大的 key 会覆盖时间戳较小的 key
-        std::sort(ssts.begin(), ssts.end());
-        uint64_t maxTime = ssts.back().getTime();
+    // 新 sstable 的文件名后缀要避开下一层已有的（包括即将被删除的输入），
+    // 以及已经合并掉、但还有读者持有所以没删的（不区分层，多避开一些无妨）
+    uint32_t maxNameSuffix = 0;
+    for (const TableRef &it : base->levels[curLevel + 1]) {
+        maxNameSuffix = it->getTime() == maxTime ? std::max(maxNameSuffix, it->getNameSuf()) : maxNameSuffix;
+    }
+    retired.erase(std::remove_if(retired.begin(), retired.end(), [](auto &it) { return it.expired(); }),
+                  retired.end());
+    for (auto &weak : retired) {
+        TableRef it = weak.lock();
+        if (it != nullptr && it->getTime() == maxTime)
+            maxNameSuffix = std::max(maxNameSuffix, it->getNameSuf());
+    }
+    bool lastLevel  = (curLevel + 1 == base->totalLevel);
+    bool bottommost = (curLevel + 1 >= base->totalLevel); // 输出是最深的一层
+    lock.unlock();
+
+    // 按分界点把整个 key 空间切成不相交的区间，每个区间一个子合并
+    // 注意下一层的输入可能超出 [minKey, maxKey]，所以首尾区间是开放的
+    std::sort(bounds.begin(), bounds.end());
+    bounds.erase(std::unique(bounds.begin(), bounds.end()), bounds.end());
+    size_t subNum = std::min<size_t>(bounds.size() + 1, std::max<uint32_t>(options.maxSubcompactions, 1));
+    std::vector<uint64_t> starts = {0};
+    for (size_t i = 1; i < subNum; ++i) {
+        starts.push_back(bounds[i * bounds.size() / subNum]); // 均匀挑选分界点
+    }
 
-        // 合并 ssts 中的 sstable
-        std::map<uint64_t, std::string> pairs;
-        merge_sstables(ssts, pairs);
+    std::atomic<uint32_t> nameSuffix(maxNameSuffix); // 保证各子合并的文件名不会重复
+    std::vector<std::vector<sstablehead>> partial_outputs(subNum);
 
-        // 生成新的 sstable
+    auto worker = [&](size_t id) {
+        uint64_t lo = starts[id];
+        uint64_t hi = (id + 1 < subNum) ? starts[id + 1] - 1 : INF;
         sstable newSs;
-        uint32_t maxNameSuffix = 0;
-        for (sstablehead &it : sstableIndex[curLevel + 1]) {
-            maxNameSuffix = it.getTime() == maxTime ? std::max(maxNameSuffix, it.getNameSuf()) : maxNameSuffix;
-        }
-        newSs.setTime(maxTime);             // 时间戳为 ssts 中最大的时间戳
-        newSs.setNamesuffix(maxNameSuffix); // 保证文件名不会重复
-
-        for (auto it : pairs) {
-            if (newSs.checkSize(it.second, curLevel + 1, 0)) {
-                addsstable(newSs, curLevel + 1);
-                newSs.reset();
-            }
+        newSs.setTime(maxTime); // 时间戳为 ssts 中最大的时间戳
+        newSs.setBlockSize(options.blockSize);
+        newSs.setCodec(codec_for_level(curLevel + 1, bottommost));
+        newSs.setBitsPerKey(options.bloomBitsPerKey);
+        newSs.setFilterPolicy(filter_for_level(curLevel + 1));
+        newSs.setRangeBitsPerKey(options.rangeFilterBitsPerKey);
+
+        auto output = [&]() {
+            newSs.setNamesuffix(nameSuffix++);
+            newSs.checkSize("", curLevel + 1, 1);
+            partial_outputs[id].push_back(newSs.getHead());
+            newSs.reset();
+        };
+
+        // 合并 ssts 中的 sstable，边归并边生成新的 sstable
+        merge_sstables(ssts, lo, hi, [&](uint64_t key, const std::string &val) {
             // 如果是最后一层，且 key 对应的 value 为 DEL，则不插入
-            if (curLevel + 1 == totalLevel && it.second == DEL) {
-                continue;
+            if (lastLevel && val == DEL) {
+                return;
             }
-            newSs.insert(it.first, it.second);
+            if (newSs.getBytes() + 12 + val.length() > MAXSIZE) {
+                output();
+            }
+            newSs.insert(key, val);
+        });
+        if (newSs.getCnt()) {
+            output();
         }
-        newSs.checkSize("", curLevel + 1, 1);
-        addsstable(newSs, curLevel + 1);
+    };
 
-        // 将 sstableIndex[curLevel+1] 排序
-        std::sort(sstableIndex[curLevel + 1].begin(), sstableIndex[curLevel + 1].end());
+    /* 创建并执行线程 */
+    std::vector<std::thread> threads;
+    for (size_t t = 1; t < subNum; ++t) {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+    for (auto &th : threads) th.join();
+
+    // 先把这次文件集合的变化原子地记入 MANIFEST，再安装
+    VersionEdit edit;
+    edit.lastTime = maxTime;
+    for (auto &outputs : partial_outputs) {
+        for (sstablehead &it : outputs) {
+            edit.added.emplace_back(curLevel + 1, it);
+        }
+    }
+    for (sstablehead &it : ssts) {
+        edit.deleted.push_back(it.getFilename());
+    }
+    manifest.logEdit(edit);
 
-        curLevel++;
+    // 安装：在最新的 Version 上删除原来的 sstables，加入新的（合并期间可能又 flush 了 level-0）
+    lock.lock();
+    auto version = std::make_shared<Version>(*current);
+    for (sstablehead &it : ssts) {
+        retire_table(*version, it.getFilename());
+    }
+    for (auto &outputs : partial_outputs) {
+        for (sstablehead &it : outputs) {
+            version->add(curLevel + 1, std::make_shared<TableMeta>(std::move(it)));
+        }
     }
 
-    // 更新 totalLevel
-    totalLevel = std::max(totalLevel, curLevel);
+    // level >= 1 保持互不相交、按 minV 排序
+    version->sortLevel(curLevel + 1);
+    install_version(version);
 }
 
-void KVStore::delsstable(std::string filename) {
-    for (int level = 0; level <= totalLevel; ++level) {
-        int size = sstableIndex[level].size(), flag = 0;
-        for (int i = 0; i < size; ++i) {
-            if (sstableIndex[level][i].getFilename() == filename) {
-                sstableIndex[level].erase(sstableIndex[level].begin() + i);
-                flag = 1;
-                break;
-            }
-        }
-        if (flag)
+void KVStore::compaction_loop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (true) {
+        int level = -1;
+        compactCv.wait(lock, [&] { return stopCompact || (level = pick_compaction_level()) >= 0; });
+        if (stopCompact)
             break;
+        compacting = true;
+        compact_level(lock, level);
+        compacting = false;
+        writeCv.notify_all(); // level-0 可能降到阈值以下了
     }
-    int flag = utils::rmfile(filename.data());
-    if (flag != 0) {
-        std::cout << "delete fail!" << std::endl;
-        std::cout << strerror(errno) << std::endl;
-    }
 }
 
+/**
+ * 阻塞直到后台合并把所有层都降到上限以内.
+ */
+void KVStore::compaction() {
+    std::unique_lock<std::mutex> lock(mtx);
+    compactCv.notify_one();
+    writeCv.wait(lock, [this] { return !compacting && pick_compaction_level() < 0; });
+}
+
+uint64_t KVStore::getCompactPointer(int level) {
+    std::lock_guard<std::mutex> lock(mtx);
+    return compactPointer[level];
+}
+
+/* level-0 文件过多时按 delayedWriteRate 限速：每攒够 1ms 的字节数就睡 1ms */
+void KVStore::delay_write(uint32_t bytes) {
+    uint64_t quantum = std::max<uint64_t>(options.delayedWriteRate / 1000, 1);
+    uint64_t prev = delayedBytes.fetch_add(bytes); // 多个写者共用一个计数，跨过 quantum 整数倍的那个去睡
+    if (prev / quantum != (prev + bytes) / quantum)
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+/* 调用时需持有 mtx */
+void KVStore::delsstable(std::string filename) {
+    auto version = std::make_shared<Version>(*current);
+    retire_table(*version, filename);
+    install_version(version);
+}
+
+/* 调用时需持有 mtx */
 void KVStore::addsstable(sstable ss, int level) {
-    sstableIndex[level].push_back(ss.getHead());
+    auto version = std::make_shared<Version>(*current);
+    version->add(level, std::make_shared<TableMeta>(ss.getHead()));
+    if (level)
+        version->sortLevel(level);
+    install_version(version);
 }
 
-char strBuf[2097152];
+/**
+ * 从 version 中去掉 filename 并标记为 obsolete：文件等最后一个持有它的 Version 释放时再删，
+ * 在那之前记在 retired 里，新文件不会重用这个名字。调用时需持有 mtx。
+ */
+void KVStore::retire_table(Version &version, const std::string &filename) {
+    TableRef table = version.remove(filename);
+    if (table == nullptr)
+        return;
+    table->markObsolete(tableCache);
+    tableCache.evict(filename); // 新的读者不会再打开它，先关掉缓存里的句柄
+    retired.push_back(table);
+}
+
+/* 换上新的 Version，调用时需持有 mtx；旧的 Version 放开 memMtx 之后才释放，可能要删除文件 */
+void KVStore::install_version(std::shared_ptr<const Version> version) {
+    {
+        std::unique_lock<std::shared_mutex> memLock(memMtx);
+        current.swap(version);
+    }
+    l0Files = current->levels[0].size();
+}
 
 /**
  * @brief Fetches a substring from a file starting at a given offset.
@@ -467,15 +1004,179 @@ char strBuf[2097152];
  * @return A string containing the read bytes.
  */
 std::string KVStore::fetchString(std::string file, int startOffset, uint32_t len) {
-    // TODO here
-    FILE *fp = fopen(file.data(), "rb");
-    if (fp == nullptr) {
-        throw std::runtime_error("open file failed");
+    return read_value(*tableCache.get(file), startOffset, len);
+}
+
+std::vector<TableFilterStats> KVStore::getFilterStats() {
+    std::shared_ptr<const Version> pinned;
+    {
+        std::shared_lock<std::shared_mutex> memLock(memMtx);
+        pinned = current;
+    }
+    std::vector<TableFilterStats> res;
+    for (int level = 0; level <= pinned->totalLevel; ++level) {
+        for (const TableRef &table : pinned->levels[level]) {
+            const TableMeta &it   = *table;
+            const FilterStats &st = *it.getStats();
+            res.push_back(TableFilterStats{level, it.getFilename(), it.getCnt(), it.getFilterPolicy(),
+                                           it.getFilterBytes(), it.getNumProbes(), st.checks.load(),
+                                           st.positives.load(), st.falsePositives.load(), it.getRangeFilterBytes(),
+                                           st.rangeChecks.load(), st.rangeSkips.load()});
+        }
     }
-    fseek(fp, startOffset, SEEK_SET);
-    fread(strBuf, 1, len, fp);
-    fclose(fp);
-    return std::string(strBuf, len);
+    return res;
+}
+
+/**
+ * 经过 block cache 读一个数据块，以块在文件中的偏移为 key；缓存的是解压后的内容.
+ * scan 传入 readahead：没命中时从预读缓冲里取，已经在预读（长 scan）时读到的块不放进 block cache。
+ */
+BlockCache::Block KVStore::read_block(
+    const TableHandle &table,
+    uint64_t offset,
+    uint32_t len,
+    ReadaheadReader *readahead
+) {
+    BlockCache::Block block = blockCache.getCapacity() ? blockCache.lookup(table.getId(), offset) : nullptr;
+    if (block != nullptr)
+        return block;
+    std::string data = readahead ? readahead->read(offset, len) : table.read(offset, len);
+    if (data.size() != len)
+        throw std::runtime_error("read file failed");
+    data = uncompressBlock(std::move(data));
+    if (!blockCache.getCapacity() || (readahead && readahead->active()))
+        return std::make_shared<const std::string>(std::move(data));
+    return blockCache.insert(table.getId(), offset, std::move(data));
+}
+
+/**
+ * 读一批数据块，可以来自多个 sstable，同一个文件的按偏移递增排在一起.
+ * 先查 block cache；没命中的在同一个文件中相邻或间隔不超过 4 个块的合成一个分散读，间隔里的字节读进丢弃的缓冲，
+ * 所有请求一起交给 asyncReader 再等它们全部完成。读短了（文件尾）就把那一组逐块重读，由长度检查报错。
+ * 映射了的文件不用读：没压缩的块直接指向映射（page cache 就是缓存，不再放进 block cache），压缩的从映射解压。
+ */
+void KVStore::read_blocks(std::vector<BlockRead> &reads) {
+    auto cached = [this](BlockRead &r, std::string data) {
+        BlockCache::Block block = blockCache.getCapacity()
+                                      ? blockCache.insert(r.table->getId(), r.offset, std::move(data))
+                                      : std::make_shared<const std::string>(std::move(data));
+        r.data = *block;
+        r.pin  = std::move(block);
+    };
+
+    std::vector<size_t> missing; // 没命中的块在 reads 中的下标
+    for (size_t i = 0; i < reads.size(); ++i) {
+        BlockRead &r = reads[i];
+        std::string_view raw;
+        if (r.table->isMapped()) {
+            raw = r.table->mapped(r.offset, r.len);
+            if (raw.size() != r.len)
+                throw std::runtime_error("read file failed");
+            if (!raw.empty() && raw.back() == CODEC_NONE) {
+                r.data = raw.substr(0, raw.size() - 1);
+                r.pin  = r.table;
+                continue;
+            }
+        }
+        BlockCache::Block block = blockCache.getCapacity() ? blockCache.lookup(r.table->getId(), r.offset) : nullptr;
+        if (block != nullptr) {
+            r.data = *block;
+            r.pin  = std::move(block);
+        } else if (r.table->isMapped()) {
+            cached(r, uncompressBlock(raw));
+        } else {
+            missing.push_back(i);
+        }
+    }
+    if (missing.empty())
+        return;
+
+    uint32_t maxGap = 4 * options.blockSize;
+    std::vector<std::string> data(missing.size());
+    std::vector<std::unique_ptr<char[]>> gaps; // 每个有间隔的请求一个，各读各的
+    std::vector<iovec> iov;
+    iov.reserve(2 * missing.size()); // 请求指向其中，不能重新分配
+    std::vector<ReadRequest> reqs;
+    std::vector<size_t> firsts; // 每个请求的第一块在 missing 中的下标
+    uint64_t end = 0;
+    char *gap    = nullptr; // 当前请求的间隔缓冲
+    for (size_t j = 0; j < missing.size(); ++j) {
+        const BlockRead &r = reads[missing[j]];
+        if (j == 0 || r.table != reads[missing[j - 1]].table || r.offset - end > maxGap
+            || reqs.back().iovcnt + 2 > IOV_MAX) {
+            reqs.push_back({r.table->getFd(), r.offset, iov.data() + iov.size(), 0});
+            firsts.push_back(j);
+            end = r.offset;
+            gap = nullptr;
+        }
+        if (r.offset > end) {
+            if (gap == nullptr)
+                gap = gaps.emplace_back(std::make_unique<char[]>(maxGap)).get();
+            iov.push_back(iovec{gap, size_t(r.offset - end)});
+            ++reqs.back().iovcnt;
+        }
+        data[j].resize(r.len);
+        iov.push_back(iovec{data[j].data(), r.len});
+        ++reqs.back().iovcnt;
+        end = r.offset + r.len;
+    }
+    firsts.push_back(missing.size());
+
+    asyncReader->read(reqs.data(), reqs.size());
+    for (size_t q = 0; q < reqs.size(); ++q) {
+        const BlockRead &last = reads[missing[firsts[q + 1] - 1]];
+        if (reqs[q].res < 0)
+            throw std::runtime_error("read file failed");
+        if (uint64_t(reqs[q].res) < last.offset + last.len - reqs[q].offset) {
+            for (size_t j = firsts[q]; j < firsts[q + 1]; ++j)
+                data[j] = reads[missing[j]].table->read(reads[missing[j]].offset, reads[missing[j]].len);
+        }
+    }
+    for (size_t j = 0; j < missing.size(); ++j) {
+        BlockRead &r = reads[missing[j]];
+        if (data[j].size() != r.len)
+            throw std::runtime_error("read file failed");
+        data[j] = uncompressBlock(std::move(data[j]));
+        cached(r, std::move(data[j]));
+    }
+}
+
+/* 第 level 层新 sstable 的压缩算法 */
+blockCodec KVStore::codec_for_level(int level, bool bottommost) {
+    if (bottommost)
+        return options.bottommostCompression;
+    if (options.compressionPerLevel.empty())
+        return CODEC_NONE;
+    return options.compressionPerLevel[std::min<size_t>(level, options.compressionPerLevel.size() - 1)];
+}
+
+/* 第 level 层新 sstable 的过滤器 */
+filterPolicy KVStore::filter_for_level(int level) {
+    if (options.filterPolicyPerLevel.empty())
+        return FILTER_BLOOM;
+    return options.filterPolicyPerLevel[std::min<size_t>(level, options.filterPolicyPerLevel.size() - 1)];
+}
+
+/* 经过 block cache 读 legacy 格式的 [offset, offset + len)，按 blockSize 对齐整块读入并缓存 */
+std::string KVStore::read_value(const TableHandle &table, uint64_t offset, uint32_t len) {
+    if (!blockCache.getCapacity() || !len)
+        return table.read(offset, len);
+
+    uint64_t bs    = std::max<uint32_t>(options.blockSize, 1);
+    uint64_t first = offset / bs, last = (offset + len - 1) / bs;
+    std::string res;
+    res.reserve(len);
+    for (uint64_t b = first; b <= last; ++b) {
+        BlockCache::Block block = blockCache.lookup(table.getId(), b);
+        if (block == nullptr)
+            block = blockCache.insert(table.getId(), b, table.read(b * bs, bs));
+        uint64_t lo = std::max(offset, b * bs) - b * bs;
+        uint64_t hi = std::min(offset + len, (b + 1) * bs) - b * bs;
+        if (hi > block->size())
+            throw std::runtime_error("read file failed");
+        res.append(*block, lo, hi - lo);
+    }
+    return res;
 }
 
 std::vector<std::pair<std::uint64_t, std::string>> KVStore::search_knn(std::string query, int k) {
@@ -503,12 +1204,16 @@ std::vector<std::pair<std::uint64_t, std::string>> KVStore::search_knn(std::vect
         [](const std::pair<uint64_t, float> &a, const std::pair<uint64_t, float> &b) { return a.second > b.second; }
     );
 
-    /* 取前k个 */
-    std::vector<std::pair<std::uint64_t, std::string>> res;
+    /* 取前k个，value 一次批量读出 */
+    std::vector<uint64_t> topKeys;
     for (int i = 0; i < k; ++i) {
         if(ksimTable.size() <= i) break;
-        res.emplace_back(ksimTable[i].first, get(ksimTable[i].first));
+        topKeys.push_back(ksimTable[i].first);
     }
+    std::vector<std::string> vals = multiGet(topKeys);
+    std::vector<std::pair<std::uint64_t, std::string>> res;
+    for (size_t i = 0; i < topKeys.size(); ++i)
+        res.emplace_back(topKeys[i], std::move(vals[i]));
 
     return res;
 }
@@ -554,12 +1259,16 @@ std::vector<std::pair<std::uint64_t, std::string>> KVStore::search_knn_parallel(
         [](const std::pair<uint64_t, float> &a, const std::pair<uint64_t, float> &b) { return a.second > b.second; }
     );
 
-    /* 取前k个 */
-    std::vector<std::pair<std::uint64_t, std::string>> res;
+    /* 取前k个，value 一次批量读出 */
+    std::vector<uint64_t> topKeys;
     for (int i = 0; i < k; ++i) {
         if(ksimTable.size() <= i) break;
-        res.emplace_back(ksimTable[i].first, get(ksimTable[i].first));
+        topKeys.push_back(ksimTable[i].first);
     }
+    std::vector<std::string> vals = multiGet(topKeys);
+    std::vector<std::pair<std::uint64_t, std::string>> res;
+    for (size_t i = 0; i < topKeys.size(); ++i)
+        res.emplace_back(topKeys[i], std::move(vals[i]));
 
     return res;
 }
@@ -1,33 +1,224 @@
 #pragma once
 
+#include "blockcache.h"
 #include "hnsw.h"
 #include "kvecTable.h"
 #include "kvstore_api.h"
+#include "manifest.h"
+#include "merger.h"
+#include "options.h"
 #include "skiplist.h"
 #include "sstable.h"
 #include "sstablehead.h"
+#include "tablecache.h"
+#include "version.h"
+#include "wal.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
 #include <map>
+#include <mutex>
 #include <set>
+#include <shared_mutex>
+#include <string_view>
+#include <thread>
+
+/* 一个 sstable 的 bloom 大小和误判统计，用来调 bloomBitsPerKey */
+struct TableFilterStats {
+    int level;
+    std::string filename;
+    uint64_t keys;
+    filterPolicy policy;
+    size_t filterBytes;
+    uint32_t numProbes;
+    uint64_t checks, positives, falsePositives;
+    size_t rangeFilterBytes;
+    uint64_t rangeChecks, rangeSkips;
+};
+
+/**
+ * 某一时刻的只读视图：seq 及之前的写入都可见，之后的都不可见.
+ * 拿着当时的 memtable、imm 和 Version：memtable 里被覆盖的旧版本按 seq 保留，
+ * 期间落盘或合并掉的 sstable 要等快照释放之后才删除。
+ * 由 KVStore::getSnapshot 创建，不能比创建它的 KVStore 活得久。
+ */
+class Snapshot {
+public:
+    uint64_t getSequence() const {
+        return seq;
+    }
+
+private:
+    friend class KVStore;
+
+    Snapshot() = default;
+
+    uint64_t seq = 0;
+    std::shared_ptr<skiplist> mem;
+    std::shared_ptr<skiplist> imm;
+    std::shared_ptr<const Version> version;
+};
+
+/**
+ * getPinned 返回的 value，不拷贝：指向 mmap 的 sstable、block cache 中的块或者自己持有的字符串（memtable 中的值）.
+ * 持有期间它指向的内存不会被释放：文件被合并掉删除之后映射要等最后一个持有者放手才解除，
+ * 块被 block cache 换出也一样。可以比 KVStore 活得久。
+ */
+class PinnedValue {
+public:
+    PinnedValue() = default;
+
+    std::string_view view() const {
+        return val;
+    }
+
+    bool empty() const { // 没找到
+        return val.empty();
+    }
+
+private:
+    friend class KVStore;
+
+    PinnedValue(std::string_view val, std::shared_ptr<const void> pin) : val(val), pin(std::move(pin)) {}
+
+    explicit PinnedValue(std::string own) {
+        auto str = std::make_shared<const std::string>(std::move(own));
+        val      = *str;
+        pin      = std::move(str);
+    }
+
+    std::string_view val;
+    std::shared_ptr<const void> pin; // val 所在内存的持有者
+};
 
 class KVStore : public KVStoreAPI {
 private:
     /* compaction 工具函数 */
     bool sstable_num_out_of_limit(int level);
-    void merge_sstables(std::vector<sstablehead> &ssts, std::map<uint64_t, std::string> &pairs);
+    int pick_compaction_level();
+    void compact_level(std::unique_lock<std::mutex> &lock, int curLevel);
+    void compaction_loop();
+    void merge_sstables(
+        std::vector<sstablehead> &ssts,
+        uint64_t lo,
+        uint64_t hi,
+        const std::function<void(uint64_t, const std::string &)> &emit
+    );
+
+    /* memtable 工具函数 */
+    bool memtable_out_of_limit(int64_t oldLen, uint32_t valLen);
+    void switch_memtable(skiplist *full);
+    void flush_memtable(skiplist *mem);
+    void flush_loop();
+    void replay_wal();
+    void load_heads(std::vector<sstablehead> *levels, int totalLevel, bool hasMeta);
+    void retire_table(Version &version, const std::string &filename);
+    void install_version(std::shared_ptr<const Version> version);
+    PinnedValue get_older(uint64_t key, skiplist *immMem, const Version &version);
+    struct TableBatch { // multiGet 中一个 sstable 要查的 key
+        const TableMeta *table;
+        std::vector<size_t> batch; // keys 中的下标，递增
+    };
+    void multiget_tables(
+        const std::vector<TableBatch> &work,
+        const std::vector<uint64_t> &keys,
+        std::vector<std::string> &found,
+        std::vector<size_t> &rest
+    );
+    std::unique_ptr<InternalIterator> table_iterator(const TableMeta &table);
+    void release_snapshot(uint64_t seq);
+    std::string read_value(const TableHandle &table, uint64_t offset, uint32_t len);
+    BlockCache::Block read_block(
+        const TableHandle &table,
+        uint64_t offset,
+        uint32_t len,
+        ReadaheadReader *readahead = nullptr
+    );
+    struct BlockRead { // read_blocks 要读的一个数据块
+        std::shared_ptr<const TableHandle> table;
+        uint64_t offset = 0;
+        uint32_t len    = 0;
+        std::string_view data           = {}; // 解压之后的内容，在 block cache 的块中或者直接在 mmap 的文件中
+        std::shared_ptr<const void> pin = {}; // data 所在内存的持有者
+    };
+    void read_blocks(std::vector<BlockRead> &reads);
+    blockCodec codec_for_level(int level, bool bottommost);
+    filterPolicy filter_for_level(int level);
+    void delay_write(uint32_t bytes);
 
 private:
+    KVStoreOptions options;
+
     // key-value
-    skiplist *s = new skiplist(0.5);           // memtable
-    std::vector<sstablehead> sstableIndex[15]; // the sshead for each level
-    int totalLevel = -1;                       // 层数
+    std::shared_ptr<skiplist> s = std::make_shared<skiplist>(0.5); // memtable
+    std::shared_ptr<skiplist> imm;             // 等待后台落盘的 immutable memtable
+    uint64_t immLog = 0;                       // imm 对应的最后一个 WAL 编号
+    WAL wal;                                   // memtable 的 write-ahead log
+    Manifest manifest;                         // 记录每层有哪些 sstable
+    std::unique_ptr<AsyncReader> asyncReader;  // 读 sstable 的 io_uring 或线程池
+    TableCache tableCache;                     // 打开的 sstable 文件句柄
+    BlockCache blockCache;                     // 热点 sstable 数据块
+    std::shared_ptr<const Version> current;    // 当前每层的 sstable，要在 tableCache 之前析构
+    uint64_t compactPointer[MAX_LEVELS] = {};  // 每层上次合并到的 key，下次从它之后取
+    uint64_t lastTime = 0;                     // 用过的最大时间戳，只有 flush 会加 1
+
+    // 合并掉但还有读者持有的 sstable，它们的文件名还不能重用
+    std::vector<std::weak_ptr<const TableMeta>> retired;
+
+    // 后台 flush 和 compaction；mtx 串行化对 imm、current、retired 和 compactPointer 的修改
+    std::mutex mtx;
+    // memMtx 保护 s、imm、current 三个指针：读者和写者共享持有，修改它们时在 mtx 之内再独占
+    std::shared_mutex memMtx;
+    std::condition_variable flushCv;   // 有新的 imm 需要落盘
+    std::condition_variable compactCv; // 有新的 level-0 文件，可能需要合并
+    std::condition_variable writeCv;   // imm 已落盘或一次合并结束
+    bool stopFlush   = false;
+    bool stopCompact = false;
+    bool compacting  = false;
+    std::thread flusher;
+    std::thread compactor;
+
+    std::atomic<size_t> l0Files{0}; // current->levels[0].size() 的无锁副本，写者限速用
+    std::atomic<uint64_t> delayedBytes{0};
+
+    // 每次写入分配一个 seq，只在内存里用，重启后从 0 开始（此时没有快照，磁盘上的数据都可见）
+    std::atomic<uint64_t> lastSeq{0};
+    std::mutex snapMtx;                      // 保护 snapshots
+    std::multiset<uint64_t> snapshots;       // 存活快照的 seq
+    std::atomic<uint64_t> newestSnapshot{0}; // 最大的存活快照，没有为 0，写者据此决定是否保留旧版本
 
     // key-vector
     KvecTable kvecTable; // memtable
     // HNSW hnsw;
 
 public:
-    KVStore(const std::string &dir);
+    /**
+     * 按 key 升序逐条读出 kv，不把结果攒在内存里；删除的 key 不出现.
+     * 读的是一个快照，遍历多久都不挡写入和合并。value 返回的视图在下一次 next/seek 之前有效。
+     * 由 newIterator 创建，不能比创建它的 KVStore 活得久。
+     */
+    class Iterator {
+    public:
+        bool valid() const;
+        uint64_t key() const;
+        std::string_view value() const;
+        void seek(uint64_t key); // 定位到第一个 >= key 的位置，创建之后要先 seek
+        void next();
+
+    private:
+        friend class KVStore;
+
+        Iterator(std::shared_ptr<const Snapshot> snapshot, std::unique_ptr<MergingIterator> iter, uint64_t upper);
+
+        void skipDeleted();
+
+        std::shared_ptr<const Snapshot> snapshot; // 要比 iter 后析构
+        std::unique_ptr<MergingIterator> iter;
+        uint64_t upper; // key 比它大就停下
+    };
+
+    KVStore(const std::string &dir, const KVStoreOptions &options = KVStoreOptions());
 
     ~KVStore();
 
@@ -35,20 +226,43 @@ public:
     void put(uint64_t key, const std::vector<float> &vec);
 
     std::string get(uint64_t key) override;
+    std::string get(uint64_t key, const Snapshot &snapshot);
+    PinnedValue getPinned(uint64_t key); // 同 get，但不拷贝 value；mmapReads 时没压缩的块直接指向文件映射
+    PinnedValue getPinned(uint64_t key, const Snapshot &snapshot);
+    std::vector<std::string> multiGet(const std::vector<uint64_t> &keys); // 和 keys 一一对应，没找到为空串
 
     bool del(uint64_t key) override;
 
     void reset() override;
 
     void scan(uint64_t key1, uint64_t key2, std::list<std::pair<uint64_t, std::string>> &list) override;
+    void scan(
+        uint64_t key1,
+        uint64_t key2,
+        std::list<std::pair<uint64_t, std::string>> &list,
+        const Snapshot &snapshot
+    );
+
+    std::shared_ptr<const Snapshot> getSnapshot(); // 最后一个 shared_ptr 释放时快照失效
 
-    void compaction();
+    // snapshot 为空时现建一个；只读到 upper 为止时，upper 之后的 sstable 不会打开
+    Iterator newIterator(std::shared_ptr<const Snapshot> snapshot = nullptr, uint64_t upper = INF);
 
-    void delsstable(std::string filename);  // 从缓存中删除filename.sst， 并物理删除
-    void addsstable(sstable ss, int level); // 将ss加入缓存
+    void compaction(); // 等待后台合并完成
+
+    uint64_t getCompactPointer(int level); // level 上次合并到的 key，下次从它之后取
+
+    void delsstable(std::string filename);  // 从当前 Version 中删除filename.sst，没有读者持有时物理删除
+    void addsstable(sstable ss, int level); // 将ss加入当前 Version
 
     std::string fetchString(std::string file, int startOffset, uint32_t len);
 
+    BlockCache &getBlockCache() {
+        return blockCache; // 命中率等统计
+    }
+
+    std::vector<TableFilterStats> getFilterStats(); // 当前每个 sstable 一项
+
     void load_embedding_from_disk(const std::string &data_root="./data/embedding_data");
     // void save_hnsw_index_to_disk(const std::string &data_root="./data/hnsw_data");
     // void load_hnsw_index_from_disk(const std::string &data_root="./data/hnsw_data");
@@ -0,0 +1,448 @@
+#include "asyncio.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <linux/io_uring.h>
+#include <mutex>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <system_error>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/* 同步做一个请求，io_uring 读短或者要重试时也用它 */
+static void readNow(ReadRequest &req) {
+    ssize_t n;
+    do
+        n = ::preadv(req.fd, req.iov, req.iovcnt, req.offset);
+    while (n < 0 && errno == EINTR);
+    req.res = n < 0 ? -errno : n;
+}
+
+namespace {
+
+/* 一个 io_uring 实例：提交队列和完成队列都 mmap 到用户态 */
+class Ring {
+public:
+    explicit Ring(unsigned entries);
+
+    ~Ring();
+
+    Ring(const Ring &)            = delete;
+    Ring &operator=(const Ring &) = delete;
+
+    unsigned capacity() const {
+        return entries;
+    }
+
+    void push(const ReadRequest &req, uint64_t userData); // 调用者保证在飞的请求不超过 capacity
+    void enter(unsigned minComplete);                     // 提交 push 过的请求，等至少 minComplete 个完成
+
+    template <typename F>
+    void reap(F &&complete) { // complete(userData, res)
+        unsigned head = *cqHead;
+        unsigned tail = std::atomic_ref<unsigned>(*cqTail).load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            const io_uring_cqe &cqe = cqes[head & cqMask];
+            complete(cqe.user_data, cqe.res);
+        }
+        std::atomic_ref<unsigned>(*cqHead).store(head, std::memory_order_release);
+    }
+
+private:
+    int fd;
+    unsigned entries;
+    void *sqRing, *cqRing;
+    size_t sqRingSize, cqRingSize;
+    io_uring_sqe *sqes;
+    unsigned *sqHead, *sqTail, *sqArray, sqMask;
+    unsigned *cqHead, *cqTail, cqMask;
+    io_uring_cqe *cqes;
+};
+
+Ring::Ring(unsigned entries) {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (fd < 0)
+        throw std::system_error(errno, std::generic_category(), "io_uring_setup");
+    this->entries = p.sq_entries;
+
+    sqRingSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqRingSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP; // 5.4 起两个队列在同一块映射里
+    if (single)
+        sqRingSize = cqRingSize = std::max(sqRingSize, cqRingSize);
+    sqRing = mmap(nullptr, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    cqRing = single ? sqRing
+                    : mmap(nullptr, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+                           IORING_OFF_CQ_RING);
+    void *sqeMem = mmap(nullptr, p.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqRing == MAP_FAILED || cqRing == MAP_FAILED || sqeMem == MAP_FAILED) {
+        int err = errno;
+        if (sqRing != MAP_FAILED)
+            munmap(sqRing, sqRingSize);
+        if (!single && cqRing != MAP_FAILED)
+            munmap(cqRing, cqRingSize);
+        if (sqeMem != MAP_FAILED)
+            munmap(sqeMem, p.sq_entries * sizeof(io_uring_sqe));
+        ::close(fd);
+        throw std::system_error(err, std::generic_category(), "io_uring mmap");
+    }
+
+    char *sq = static_cast<char *>(sqRing), *cq = static_cast<char *>(cqRing);
+    sqes    = static_cast<io_uring_sqe *>(sqeMem);
+    sqHead  = reinterpret_cast<unsigned *>(sq + p.sq_off.head);
+    sqTail  = reinterpret_cast<unsigned *>(sq + p.sq_off.tail);
+    sqArray = reinterpret_cast<unsigned *>(sq + p.sq_off.array);
+    sqMask  = *reinterpret_cast<unsigned *>(sq + p.sq_off.ring_mask);
+    cqHead  = reinterpret_cast<unsigned *>(cq + p.cq_off.head);
+    cqTail  = reinterpret_cast<unsigned *>(cq + p.cq_off.tail);
+    cqMask  = *reinterpret_cast<unsigned *>(cq + p.cq_off.ring_mask);
+    cqes    = reinterpret_cast<io_uring_cqe *>(cq + p.cq_off.cqes);
+}
+
+Ring::~Ring() {
+    munmap(sqes, entries * sizeof(io_uring_sqe));
+    if (cqRing != sqRing)
+        munmap(cqRing, cqRingSize);
+    munmap(sqRing, sqRingSize);
+    ::close(fd);
+}
+
+void Ring::push(const ReadRequest &req, uint64_t userData) {
+    unsigned tail     = *sqTail;
+    unsigned i        = tail & sqMask;
+    io_uring_sqe &sqe = sqes[i];
+    memset(&sqe, 0, sizeof(sqe));
+    sqe.opcode    = IORING_OP_READV;
+    sqe.fd        = req.fd;
+    sqe.off       = req.offset;
+    sqe.addr      = reinterpret_cast<uint64_t>(req.iov);
+    sqe.len       = req.iovcnt;
+    sqe.user_data = userData;
+    sqArray[i]    = i;
+    std::atomic_ref<unsigned>(*sqTail).store(tail + 1, std::memory_order_release);
+}
+
+void Ring::enter(unsigned minComplete) {
+    for (;;) {
+        // 没有 SQPOLL 时内核在 io_uring_enter 里取走提交的请求，head 就是已经取走的位置
+        unsigned toSubmit = *sqTail - std::atomic_ref<unsigned>(*sqHead).load(std::memory_order_acquire);
+        if (toSubmit == 0 && minComplete == 0)
+            return;
+        int r = syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, minComplete ? IORING_ENTER_GETEVENTS : 0,
+                        nullptr, 0);
+        if (r >= 0)
+            return;
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+            throw std::system_error(errno, std::generic_category(), "io_uring_enter");
+    }
+}
+
+class IoUringReader : public AsyncReader {
+public:
+    explicit IoUringReader(unsigned queueDepth) : queueDepth(queueDepth) {
+        release(std::make_unique<Ring>(queueDepth)); // 内核不支持时在这里抛异常
+    }
+
+    std::unique_ptr<Batch> submit(ReadRequest *reqs, size_t n) override;
+    void read(ReadRequest *reqs, size_t n) override; // 提交和等待合在一次 io_uring_enter 里
+
+    const char *name() const override {
+        return "io_uring";
+    }
+
+private:
+    class UringBatch;
+
+    std::unique_ptr<Ring> acquire();
+    void release(std::unique_ptr<Ring> ring);
+
+    unsigned queueDepth;
+    std::mutex mtx;
+    std::vector<std::unique_ptr<Ring>> rings; // 空闲的 ring
+};
+
+/* 先把 ring 填满，剩下的在等待时随完成随补；submitNow 为 false 时留到 wait 里和等待一起提交 */
+class IoUringReader::UringBatch : public Batch {
+public:
+    UringBatch(IoUringReader &owner, ReadRequest *reqs, size_t n, bool submitNow) :
+        owner(owner), ring(owner.acquire()), reqs(reqs), n(n) {
+        fill();
+        if (submitNow)
+            ring->enter(0);
+    }
+
+    ~UringBatch() override {
+        wait();
+    }
+
+    void wait() override;
+
+private:
+    void fill() {
+        for (; next < n && inflight < ring->capacity(); ++next, ++inflight)
+            ring->push(reqs[next], next);
+    }
+
+    IoUringReader &owner;
+    std::unique_ptr<Ring> ring; // 等完之后放回 owner
+    ReadRequest *reqs;
+    size_t n;
+    size_t next = 0, inflight = 0, completed = 0;
+};
+
+void IoUringReader::UringBatch::wait() {
+    if (ring == nullptr)
+        return;
+    while (completed < n) {
+        ring->enter(1);
+        ring->reap([this](uint64_t i, int res) {
+            reqs[i].res = res;
+            --inflight;
+            ++completed;
+        });
+        fill();
+    }
+    owner.release(std::move(ring));
+    for (size_t i = 0; i < n; ++i)
+        if (reqs[i].res == -EAGAIN || reqs[i].res == -EINTR || reqs[i].res == -ECANCELED)
+            readNow(reqs[i]);
+}
+
+std::unique_ptr<AsyncReader::Batch> IoUringReader::submit(ReadRequest *reqs, size_t n) {
+    return std::make_unique<UringBatch>(*this, reqs, n, true);
+}
+
+void IoUringReader::read(ReadRequest *reqs, size_t n) {
+    if (n == 1) { // 没有可以重叠的，一次 preadv 比经过 ring 便宜
+        readNow(reqs[0]);
+        return;
+    }
+    UringBatch(*this, reqs, n, false).wait();
+}
+
+std::unique_ptr<Ring> IoUringReader::acquire() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (!rings.empty()) {
+            std::unique_ptr<Ring> ring = std::move(rings.back());
+            rings.pop_back();
+            return ring;
+        }
+    }
+    return std::make_unique<Ring>(queueDepth); // 同时在等的批次比 ring 多
+}
+
+void IoUringReader::release(std::unique_ptr<Ring> ring) {
+    std::lock_guard<std::mutex> lock(mtx);
+    rings.push_back(std::move(ring));
+}
+
+/* 内核没有 io_uring 时的退路：线程池里做 preadv */
+class ThreadPoolReader : public AsyncReader {
+public:
+    explicit ThreadPoolReader(unsigned threads);
+
+    ~ThreadPoolReader() override;
+
+    std::unique_ptr<Batch> submit(ReadRequest *reqs, size_t n) override;
+
+    const char *name() const override {
+        return "thread pool";
+    }
+
+private:
+    class PoolBatch;
+
+    void work();
+    ReadRequest *claim(PoolBatch *batch); // 在 mtx 下领一个还没开始的请求，领完了返回 nullptr
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<PoolBatch *> queue; // 还有请求没被领走的批次
+    bool stop = false;
+    std::vector<std::thread> workers;
+};
+
+/* 工作线程和等待的线程都从同一批里领请求，等待的线程领完了就只剩等 */
+class ThreadPoolReader::PoolBatch : public Batch {
+public:
+    PoolBatch(ThreadPoolReader &owner, ReadRequest *reqs, size_t n) : owner(owner), reqs(reqs), n(n) {}
+
+    ~PoolBatch() override {
+        wait();
+    }
+
+    void wait() override;
+
+    void finish() {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (++done == n)
+            cv.notify_one(); // 在锁内通知，等待者醒来时这里已经不再碰 batch
+    }
+
+private:
+    friend class ThreadPoolReader;
+
+    ThreadPoolReader &owner;
+    ReadRequest *reqs;
+    size_t n;
+    size_t claimed = 0; // 由 owner.mtx 保护
+    size_t done    = 0; // 由 mtx 保护
+    bool waited    = false;
+    std::mutex mtx;
+    std::condition_variable cv;
+};
+
+void ThreadPoolReader::PoolBatch::wait() {
+    if (waited)
+        return;
+    waited = true;
+    for (;;) {
+        ReadRequest *req;
+        {
+            std::lock_guard<std::mutex> lock(owner.mtx);
+            req = owner.claim(this);
+        }
+        if (req == nullptr)
+            break;
+        readNow(*req);
+        finish();
+    }
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return done == n; });
+}
+
+ThreadPoolReader::ThreadPoolReader(unsigned threads) {
+    for (unsigned i = 0; i < threads; ++i)
+        workers.emplace_back(&ThreadPoolReader::work, this);
+}
+
+ThreadPoolReader::~ThreadPoolReader() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    cv.notify_all();
+    for (auto &t : workers)
+        t.join();
+}
+
+ReadRequest *ThreadPoolReader::claim(PoolBatch *batch) {
+    if (batch->claimed == batch->n)
+        return nullptr;
+    ReadRequest *req = &batch->reqs[batch->claimed++];
+    if (batch->claimed == batch->n) {
+        auto it = std::find(queue.begin(), queue.end(), batch);
+        if (it != queue.end())
+            queue.erase(it);
+    }
+    return req;
+}
+
+void ThreadPoolReader::work() {
+    for (;;) {
+        PoolBatch *batch;
+        ReadRequest *req;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            cv.wait(lock, [this] { return stop || !queue.empty(); });
+            if (queue.empty())
+                return;
+            batch = queue.front();
+            req   = claim(batch);
+        }
+        readNow(*req);
+        batch->finish();
+    }
+}
+
+std::unique_ptr<AsyncReader::Batch> ThreadPoolReader::submit(ReadRequest *reqs, size_t n) {
+    auto batch = std::make_unique<PoolBatch>(*this, reqs, n);
+    if (n > 1 && !workers.empty()) { // 只有一个请求时留给等待的线程自己做
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            queue.push_back(batch.get());
+        }
+        if (n - 1 >= workers.size())
+            cv.notify_all();
+        else
+            for (size_t i = 1; i < n; ++i)
+                cv.notify_one();
+    }
+    return batch;
+}
+
+} // namespace
+
+std::unique_ptr<AsyncReader> AsyncReader::create(AsyncIoMode mode, unsigned queueDepth, unsigned threads) {
+    if (mode != AIO_THREAD_POOL) {
+        try {
+            return std::make_unique<IoUringReader>(std::max(queueDepth, 1u));
+        } catch (const std::system_error &) {
+            if (mode == AIO_IO_URING)
+                throw;
+        }
+    }
+    return std::make_unique<ThreadPoolReader>(threads);
+}
+
+SequentialReader::SequentialReader(AsyncReader &io, int fd, uint32_t chunkSize) :
+    io(io), fd(fd), chunkSize(chunkSize) {}
+
+SequentialReader::~SequentialReader() {
+    next.pending = nullptr; // 等预读完成，缓冲才能释放
+}
+
+void SequentialReader::start(Chunk &chunk, uint64_t offset, uint32_t len) {
+    chunk.start = offset;
+    chunk.size  = 0;
+    chunk.data.resize(len);
+    chunk.iov     = {chunk.data.data(), len};
+    chunk.req     = {fd, offset, &chunk.iov, 1};
+    chunk.pending = io.submit(&chunk.req, 1);
+}
+
+void SequentialReader::finish(Chunk &chunk) {
+    chunk.pending->wait();
+    chunk.pending = nullptr;
+    if (chunk.req.res < 0)
+        throw std::system_error(-chunk.req.res, std::generic_category(), "read file failed");
+    chunk.size = chunk.req.res;
+}
+
+std::string SequentialReader::read(uint64_t offset, uint32_t len) {
+    std::string res;
+    res.reserve(len);
+    while (res.size() < len) {
+        uint64_t pos = offset + res.size();
+        if (pos >= cur.start && pos < cur.start + cur.size) {
+            size_t n = std::min<uint64_t>(len - res.size(), cur.start + cur.size - pos);
+            res.append(cur.data, pos - cur.start, n);
+            continue;
+        }
+        if (next.pending != nullptr && next.start == pos) { // 预读的正好接上
+            finish(next);
+            std::swap(cur, next);
+        } else { // 第一次读或者跳着读
+            if (next.pending != nullptr)
+                finish(next);
+            start(cur, pos, std::max<uint32_t>(chunkSize, len - res.size()));
+            finish(cur);
+        }
+        if (cur.size == 0)
+            break; // 文件尾
+        if (cur.size == cur.data.size())
+            start(next, cur.start + cur.size, chunkSize);
+    }
+    return res;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/uio.h>
+
+/* 一个（分散）读请求：从 fd 的 offset 处依次读满 iov；完成后 res 为读到的字节数（文件尾会变短），出错为 -errno */
+struct ReadRequest {
+    int fd;
+    uint64_t offset;
+    const iovec *iov;
+    int iovcnt;
+    int64_t res = 0;
+};
+
+/* 异步读用哪种实现 */
+enum AsyncIoMode {
+    AIO_AUTO,       // 能用 io_uring 就用，否则退回线程池
+    AIO_IO_URING,   // 只用 io_uring，不可用时 create 抛异常
+    AIO_THREAD_POOL // 线程池里做 preadv
+};
+
+/**
+ * 异步读引擎：一次提交一批读，之后再等它们完成，一个线程就能让几十个读同时在盘上排队.
+ *
+ * io_uring 直接用系统调用（不依赖 liburing），每个还没等完的批次占用池里的一个 ring，等完放回；
+ * 内核不支持（< 5.1）或者被 seccomp 禁用时退回线程池，每个请求一次 preadv，等待的线程自己也做一部分。
+ * 可以多线程同时使用，一个 Batch 只能由一个线程等待。
+ */
+class AsyncReader {
+public:
+    /* 一批已经提交的请求；析构时如果还没等过会先等它们完成 */
+    class Batch {
+    public:
+        virtual ~Batch() = default;
+
+        virtual void wait() = 0; // 返回时每个请求的 res 都已经填好
+    };
+
+    static std::unique_ptr<AsyncReader> create(AsyncIoMode mode, unsigned queueDepth, unsigned threads);
+
+    virtual ~AsyncReader() = default;
+
+    /* 提交后立即返回；reqs 和它们指向的缓冲在 wait 返回之前不能移动或释放 */
+    virtual std::unique_ptr<Batch> submit(ReadRequest *reqs, size_t n) = 0;
+
+    virtual void read(ReadRequest *reqs, size_t n) { // 提交并等待
+        submit(reqs, n)->wait();
+    }
+
+    virtual const char *name() const = 0;
+};
+
+/**
+ * 顺序读一个文件：读当前这一段的同时在后台读下一段，合并时 CPU 和磁盘可以重叠.
+ * 往回或者跳着读时丢掉预读的那一段，重新同步读。不能多线程同时使用。
+ */
+class SequentialReader {
+public:
+    SequentialReader(AsyncReader &io, int fd, uint32_t chunkSize);
+
+    ~SequentialReader();
+
+    SequentialReader(const SequentialReader &)            = delete;
+    SequentialReader &operator=(const SequentialReader &) = delete;
+
+    std::string read(uint64_t offset, uint32_t len); // 读到文件尾会变短
+
+private:
+    struct Chunk {
+        uint64_t start = 0;
+        size_t size    = 0; // data 中读到的字节数
+        std::string data;
+        iovec iov;
+        ReadRequest req;
+        std::unique_ptr<AsyncReader::Batch> pending; // 还没等待的读
+    };
+
+    void start(Chunk &chunk, uint64_t offset, uint32_t len); // 提交读 [offset, offset + len)
+    void finish(Chunk &chunk);                               // 等 chunk 读完
+
+    AsyncReader &io;
+    int fd;
+    uint32_t chunkSize;
+    Chunk cur, next; // 正在用的一段和预读的下一段
+};
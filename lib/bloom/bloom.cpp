@@ -1,18 +1,121 @@
 #include "bloom.h"
 
+#include <algorithm>
+#include <cmath>
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__)) && !defined(BLOOM_NO_SIMD)
+#include <immintrin.h>
+#define BLOOM_AVX2 1
+#endif
+
+static const uint32_t PROBE_MULT = 0x9e3779b9;
+
+/* MurmurHash3 的 fmix64，一次乘加移位把 key 打散 */
+static inline uint64_t hash64(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdull;
+    key ^= key >> 33;
+    key *= 0xc4ceb9fe1a85ec53ull;
+    key ^= key >> 33;
+    return key;
+}
+
+/* legacy 布局的 4 个探测点；MurmurHash3 按 uint64_t 写出结果，这里也按 uint64_t 取，避免别名问题 */
+static inline void legacyProbes(uint64_t key, uint32_t probes[4]) {
+    uint64_t h[2];
+    MurmurHash3_x64_128(&key, sizeof(key), 1, h);
+    probes[0] = static_cast<uint32_t>(h[0]) % (8 * M);
+    probes[1] = static_cast<uint32_t>(h[0] >> 32) % (8 * M);
+    probes[2] = static_cast<uint32_t>(h[1]) % (8 * M);
+    probes[3] = static_cast<uint32_t>(h[1] >> 32) % (8 * M);
+}
+
+static inline uint32_t pickLine(uint64_t h, uint32_t lines) {
+    return (static_cast<uint64_t>(static_cast<uint32_t>(h)) * lines) >> 32; // 代替取模
+}
+
+#ifdef BLOOM_AVX2
+/* 8 个 lane 分别算第 0..7 次探测：h2 * PROBE_MULT^i，取高 4 位选 word、接下来 5 位选 bit */
+__attribute__((target("avx2"))) static bool probeAvx2(const uint32_t *line, uint32_t h2, uint32_t numProbes) {
+    const __m256i mults = _mm256_setr_epi32(0x1, 0x9e3779b9, 0xe35e67b1, 0x734297e9, 0x35fbe861, 0xdeb7c719,
+                                            0x448b211, 0x3459b749);
+    __m256i h       = _mm256_mullo_epi32(_mm256_set1_epi32(h2), mults);
+    __m256i wordIdx = _mm256_srli_epi32(h, 28);
+    __m256i bitIdx  = _mm256_and_si256(_mm256_srli_epi32(h, 23), _mm256_set1_epi32(31));
+
+    __m256i lo    = _mm256_load_si256(reinterpret_cast<const __m256i *>(line));
+    __m256i hi    = _mm256_load_si256(reinterpret_cast<const __m256i *>(line + 8));
+    __m256i useHi = _mm256_cmpgt_epi32(wordIdx, _mm256_set1_epi32(7));
+    __m256i words = _mm256_blendv_epi8(_mm256_permutevar8x32_epi32(lo, wordIdx),
+                                       _mm256_permutevar8x32_epi32(hi, wordIdx), useHi);
+    __m256i hit   = _mm256_and_si256(words, _mm256_sllv_epi32(_mm256_set1_epi32(1), bitIdx));
+
+    // 只看前 numProbes 个 lane，其中有一个 bit 没被置上就一定不存在
+    __m256i used = _mm256_cmpgt_epi32(_mm256_set1_epi32(numProbes), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+    __m256i miss = _mm256_and_si256(_mm256_cmpeq_epi32(hit, _mm256_setzero_si256()), used);
+    return _mm256_testz_si256(miss, miss);
+}
+
+static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+#endif
+
+bloom::bloom(uint64_t keys, uint32_t bitsPerKey) {
+    if (!bitsPerKey || !keys)
+        return;
+    uint64_t bits = keys * bitsPerKey;
+    lines.assign((bits + 8 * sizeof(Line) - 1) / (8 * sizeof(Line)), Line{});
+    // 误判率最低的探测次数是 bitsPerKey * ln2
+    numProbes = std::clamp<uint32_t>(std::lround(bitsPerKey * 0.69), 1, MAX_PROBES);
+}
+
+void bloom::load(const char *src, size_t bytes, bool blocked, uint32_t numProbes) {
+    lines.resize(bytes / sizeof(Line));
+    memcpy(lines.data(), src, size());
+    this->blocked   = blocked;
+    this->numProbes = std::clamp<uint32_t>(numProbes, 1, MAX_PROBES);
+}
+
 void bloom::insert(uint64_t key) {
-    MurmurHash3_x64_128(&key, sizeof(key), 1, hashV);
-    for (int i = 0; i < 4; ++i) {
-        uint32_t p = (hashV[i] % (8 * M));
-        s[p]       = true;
+    if (lines.empty())
+        return;
+    if (!blocked) {
+        uint32_t probes[4];
+        legacyProbes(key, probes);
+        for (int i = 0; i < 4; ++i)
+            setBit(probes[i]);
+        return;
+    }
+    uint64_t h     = hash64(key);
+    uint32_t *line = lines[pickLine(h, lines.size())].w;
+    uint32_t h2    = h >> 32;
+    for (uint32_t i = 0; i < numProbes; ++i, h2 *= PROBE_MULT)
+        line[h2 >> 28] |= 1u << ((h2 >> 23) & 31);
+}
+
+bool bloom::searchBlocked(uint64_t key) const {
+    uint64_t h           = hash64(key);
+    const uint32_t *line = lines[pickLine(h, lines.size())].w;
+    uint32_t h2          = h >> 32;
+#ifdef BLOOM_AVX2
+    if (hasAvx2)
+        return probeAvx2(line, h2, numProbes);
+#endif
+    for (uint32_t i = 0; i < numProbes; ++i, h2 *= PROBE_MULT) {
+        if (!((line[h2 >> 28] >> ((h2 >> 23) & 31)) & 1))
+            return false;
     }
+    return true;
 }
 
-bool bloom::search(uint64_t key) {
-    MurmurHash3_x64_128(&key, sizeof(key), 1, hashV);
+bool bloom::search(uint64_t key) const {
+    if (lines.empty())
+        return true; // 没有 filter
+    if (blocked)
+        return searchBlocked(key);
+    uint32_t probes[4];
+    legacyProbes(key, probes);
     for (int i = 0; i < 4; ++i) {
-        uint32_t p = (hashV[i] % (8 * M));
-        if (!s[p])
+        if (!getBit(probes[i]))
             return false;
     }
     return true;
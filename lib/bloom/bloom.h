@@ -2,45 +2,87 @@
 #define LSM_KV_BLOOM_H
 #include "./utils/MurmurHash3.h"
 
-#include <bitset>
 #include <cstdint>
+#include <cstring>
+#include <vector>
 
-const uint32_t M = 10240;
+const uint32_t M = 10240; // legacy 布局固定的字节数
 
+/**
+ * bloom filter，有两种布局:
+ * - legacy：固定 M 字节，MurmurHash3 的 4 个 32 位结果分别对 8*M 取模，探测点散布在整个 10KB
+ * - blocked：按 key 数和 bitsPerKey 决定有多少条 64 字节的 cache line。
+ *   一个 64 位哈希，低 32 位选出一条 cache line，高 32 位每次乘一个常数取高 9 位，
+ *   在这 512 位里探测 numProbes 次；一次查询只碰一条 cache line，支持 AVX2 时 8 个探测一起做
+ * 位的排列与文件中的字节一致：第 i 位是第 i/8 个字节的第 i%8 位。
+ * 没有任何 cache line 的 filter（bitsPerKey 为 0）不排除任何 key。
+ */
 class bloom {
 private:
-    std::bitset<8 * M> s;
-    uint32_t hashV[4];
+    static constexpr uint32_t LINE_WORDS = 16; // 每条 cache line 16 个 uint32
+    static constexpr uint32_t MAX_PROBES = 8;  // AVX2 一次做完；块内再多探测收益也很小
+
+    struct alignas(64) Line {
+        uint32_t w[LINE_WORDS];
+    };
+
+    std::vector<Line> lines;
+    bool blocked       = true;
+    uint32_t numProbes = 4;
+
+    bool searchBlocked(uint64_t key) const;
+
+    uint32_t *words() {
+        return lines.data()->w;
+    }
+
+    const uint32_t *words() const {
+        return lines.data()->w;
+    }
 
 public:
     bloom() {}
 
-    ~bloom() {
-        s.reset();
-    }
+    bloom(uint64_t keys, uint32_t bitsPerKey); // blocked 布局，大小和探测次数按 bitsPerKey 取最优
 
     void reset() {
-        s.reset();
+        memset(lines.data(), 0, size());
     }
 
-    void setBitset(std::bitset<8 * M> t) {
-        s = t;
+    void setLegacy() { // 清空成 M 字节的 legacy 布局
+        lines.assign(M / 64, Line{});
+        blocked = false;
     }
 
-    std::bitset<8 * M> getBitset() {
-        return s;
+    bool isBlocked() const {
+        return blocked;
     }
 
-    bool getBit(uint32_t p) {
-        return s[p];
+    uint32_t getNumProbes() const {
+        return numProbes;
+    }
+
+    size_t size() const { // 字节数
+        return lines.size() * sizeof(Line);
+    }
+
+    bool getBit(uint32_t p) const {
+        return (words()[p >> 5] >> (p & 31)) & 1;
     }
 
     void setBit(uint32_t p) {
-        s[p] = true;
+        words()[p >> 5] |= 1u << (p & 31);
     }
 
+    const char *data() const { // size() 字节，即文件中的格式
+        return reinterpret_cast<const char *>(lines.data());
+    }
+
+    /* 从文件内容载入；bytes 必须是 64 的倍数，legacy 布局是 M */
+    void load(const char *src, size_t bytes, bool blocked, uint32_t numProbes);
+
     void insert(uint64_t key);
-    bool search(uint64_t key);
+    bool search(uint64_t key) const;
 };
 
 #endif // LSM_KV_BLOOM_H
@@ -0,0 +1,172 @@
+#include "lz.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+static const size_t MIN_MATCH    = 4;
+static const int HASH_BITS       = 14;
+static const uint32_t MAX_OFFSET = 65535;
+static const int MAX_ATTEMPTS    = 64; // high 模式每个位置最多比较的候选数
+
+static inline uint32_t read32(const char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t hash4(const char *p) {
+    return (read32(p) * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void putLength(std::string &dst, size_t len) {
+    while (len >= 255) {
+        dst += static_cast<char>(255);
+        len -= 255;
+    }
+    dst += static_cast<char>(len);
+}
+
+/* 输出一个 sequence；matchLen 为 0 表示最后一段，只有字面量 */
+static void emit(std::string &dst, const char *lit, size_t litLen, uint32_t offset, size_t matchLen) {
+    size_t ml = matchLen ? matchLen - MIN_MATCH : 0;
+    dst += static_cast<char>((std::min<size_t>(litLen, 15) << 4) | std::min<size_t>(ml, 15));
+    if (litLen >= 15)
+        putLength(dst, litLen - 15);
+    dst.append(lit, litLen);
+    if (!matchLen)
+        return;
+    dst += static_cast<char>(offset & 0xFF);
+    dst += static_cast<char>(offset >> 8);
+    if (ml >= 15)
+        putLength(dst, ml - 15);
+}
+
+std::string lz::compress(const std::string &src, bool high) {
+    std::string dst;
+    for (uint64_t v = src.size(); ; v >>= 7) { // varint rawLen
+        if (v < 0x80) {
+            dst += static_cast<char>(v);
+            break;
+        }
+        dst += static_cast<char>(v | 0x80);
+    }
+
+    const char *base = src.data();
+    size_t n         = src.size();
+    std::vector<int32_t> head(1 << HASH_BITS, -1);
+    std::vector<int32_t> chain(high ? n : 0); // 同一个哈希值的上一个位置
+    auto insert = [&](size_t pos) {
+        uint32_t h = hash4(base + pos);
+        if (high)
+            chain[pos] = head[h];
+        head[h] = pos;
+    };
+
+    size_t anchor = 0, i = 0;
+    while (i + MIN_MATCH <= n) {
+        size_t bestLen = 0, bestOff = 0;
+        int32_t cand   = head[hash4(base + i)];
+        for (int attempts = high ? MAX_ATTEMPTS : 1; cand >= 0 && attempts > 0 && i - cand <= MAX_OFFSET; --attempts) {
+            if (read32(base + cand) == read32(base + i)) {
+                size_t len = MIN_MATCH;
+                while (i + len < n && base[cand + len] == base[i + len])
+                    len++;
+                if (len > bestLen) {
+                    bestLen = len;
+                    bestOff = i - cand;
+                }
+            }
+            cand = high ? chain[cand] : -1;
+        }
+        insert(i);
+        if (bestLen < MIN_MATCH) {
+            i += high ? 1 : 1 + ((i - anchor) >> 6); // fast 模式在不可压缩的数据上逐渐加大步长
+            continue;
+        }
+        emit(dst, base + anchor, i - anchor, bestOff, bestLen);
+        size_t end = i + bestLen;
+        if (high) { // 匹配内部的位置也加入哈希链，提高后面的匹配长度
+            for (size_t j = i + 1; j < end && j + MIN_MATCH <= n; ++j)
+                insert(j);
+        }
+        i = anchor = end;
+    }
+    emit(dst, base + anchor, n - anchor, 0, 0);
+    return dst;
+}
+
+bool lz::uncompress(const char *src, size_t n, std::string &dst) {
+    const unsigned char *p   = reinterpret_cast<const unsigned char *>(src);
+    const unsigned char *end = p + n;
+
+    uint64_t rawLen = 0;
+    for (int shift = 0;; shift += 7) {
+        if (p >= end || shift > 63)
+            return false;
+        uint64_t byte = *p++;
+        rawLen |= (byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            break;
+    }
+    auto getLength = [&](size_t &len) {
+        while (p < end) {
+            unsigned char b = *p++;
+            len += b;
+            if (b != 255)
+                return true;
+        }
+        return false;
+    };
+
+    // 多留 WILD 字节，短的字面量和匹配可以整块多复制一些，省掉按长度分支
+    const size_t WILD = 16;
+    dst.resize(rawLen + WILD);
+    char *out = &dst[0], *outEnd = out + rawLen;
+    while (p < end) {
+        unsigned char token = *p++;
+        size_t lit          = token >> 4;
+        if (lit == 15 && !getLength(lit))
+            return false;
+        if (lit > static_cast<size_t>(end - p) || lit > static_cast<size_t>(outEnd - out))
+            return false;
+        if (lit <= WILD && end - p >= (long)WILD)
+            memcpy(out, p, WILD);
+        else
+            memcpy(out, p, lit);
+        p += lit;
+        out += lit;
+        if (p == end)
+            break; // 最后一段只有字面量
+
+        if (end - p < 2)
+            return false;
+        uint32_t offset = p[0] | (p[1] << 8);
+        p += 2;
+        size_t ml = token & 15;
+        if (ml == 15 && !getLength(ml))
+            return false;
+        ml += MIN_MATCH;
+        if (offset == 0 || offset > static_cast<size_t>(out - &dst[0]) || ml > static_cast<size_t>(outEnd - out))
+            return false;
+        const char *m = out - offset;
+        if (offset >= WILD && ml <= WILD) {
+            memcpy(out, m, WILD);
+        } else if (offset >= ml) {
+            memcpy(out, m, ml);
+        } else {
+            // 与输出重叠：从匹配起点复制，已经复制好的部分可以接着当源，每次复制的长度翻倍
+            for (size_t done = 0; done < ml;) {
+                size_t c = std::min<size_t>(out + done - m, ml - done);
+                memcpy(out + done, m, c);
+                done += c;
+            }
+        }
+        out += ml;
+    }
+    if (out != outEnd)
+        return false;
+    dst.resize(rawLen);
+    return true;
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#ifndef LSM_KV_LZ_H
+#define LSM_KV_LZ_H
+
+#include <string>
+
+/**
+ * 仿照 LZ4 的小型 LZ77 压缩，不用字典.
+ *
+ * 输出为 varint(rawLen)，之后是若干个序列
+ *   token | [字面量长度字节] | 字面量 | offset(u16) | [匹配长度字节]
+ * token 高 4 位是 min(字面量长度, 15)，低 4 位是 min(匹配长度 - 4, 15)；为 15 时后面接若干个 255，
+ * 以一个更小的字节结束。最后一个序列只有字面量。
+ * high 时沿哈希链找最长的匹配，而不是取第一个候选：压缩更慢、压缩率更高，解压不变。
+ */
+namespace lz {
+std::string compress(const std::string &src, bool high = false);
+bool uncompress(const char *src, size_t n, std::string &dst); // 数据损坏返回 false
+
+inline bool uncompress(const std::string &src, std::string &dst) {
+    return uncompress(src.data(), src.size(), dst);
+}
+} // namespace lz
+
+#endif // LSM_KV_LZ_H
@@ -0,0 +1,28 @@
+#include "arena.h"
+
+char *Arena::allocateFallback(size_t bytes) {
+    if (bytes > BLOCK_SIZE / 4)
+        return allocateBlock(bytes); // 大的单独一块，当前块剩下的留给后面的小请求
+
+    ptr       = allocateBlock(BLOCK_SIZE);
+    remaining = BLOCK_SIZE - bytes;
+    char *res = ptr;
+    ptr += bytes;
+    return res;
+}
+
+char *Arena::allocateBlock(size_t bytes) {
+    char *block = new char[bytes];
+    blocks.push_back(block);
+    usage += bytes + sizeof(char *);
+    return block;
+}
+
+void Arena::reset() {
+    for (char *block : blocks)
+        delete[] block;
+    blocks.clear();
+    ptr       = nullptr;
+    remaining = 0;
+    usage     = 0;
+}
@@ -0,0 +1,54 @@
+#ifndef LSM_KV_ARENA_H
+#define LSM_KV_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * 只分配不释放的内存池，memtable 的节点都从这里拿.
+ *
+ * 每次从当前块切出一段，块用完就再 new 一块；较大的请求单独分配一块，
+ * 避免浪费当前块剩下的空间。reset() 一次释放全部块。
+ */
+class Arena {
+public:
+    Arena() {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    ~Arena() {
+        reset();
+    }
+
+    char *allocate(size_t bytes) { // 按 8 字节对齐
+        bytes = (bytes + ALIGN - 1) & ~(ALIGN - 1);
+        if (bytes <= remaining) {
+            char *res = ptr;
+            ptr += bytes;
+            remaining -= bytes;
+            return res;
+        }
+        return allocateFallback(bytes);
+    }
+
+    size_t memoryUsage() const { // 已经向系统申请的字节数
+        return usage;
+    }
+
+    void reset();
+
+private:
+    static const size_t ALIGN      = 8;
+    static const size_t BLOCK_SIZE = 64 * 1024;
+
+    char *allocateFallback(size_t bytes);
+    char *allocateBlock(size_t bytes);
+
+    char *ptr        = nullptr;
+    size_t remaining = 0;
+    size_t usage     = 0;
+    std::vector<char *> blocks;
+};
+
+#endif // LSM_KV_ARENA_H
@@ -1,9 +1,71 @@
 #include "skiplist.h"
 
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <random>
 #include <vector>
 
+static size_t valueSize(size_t len) {
+    return offsetof(slvalue, data) + len;
+}
+
+/* 在 mem 处构造一个版本 */
+const slvalue *skiplist::newValue(const std::string &val, uint64_t seq, const slvalue *prev, char *mem) {
+    slvalue *v = reinterpret_cast<slvalue *>(mem);
+    v->seq     = seq;
+    v->prev    = prev;
+    v->len     = val.size();
+    memcpy(v->data, val.data(), val.size());
+    return v;
+}
+
+/* inArena 为 false 时单独 new 出来（head 和 tail，reset 后仍然要用） */
+slnode *skiplist::newNode(uint64_t key, const std::string &val, uint64_t seq, TYPE type, int height, bool inArena) {
+    size_t tower = offsetof(slnode, nxt) + sizeof(std::atomic<slnode *>) * height;
+    size_t size  = tower + valueSize(val.size());
+    char *mem;
+    if (inArena) {
+        std::lock_guard<std::mutex> lock(arenaMtx);
+        mem = arena.allocate(size);
+        memUsage.store(arena.memoryUsage(), std::memory_order_relaxed);
+    } else {
+        mem = new char[size];
+    }
+    const slvalue *v = newValue(val, seq, nullptr, mem + tower);
+
+    slnode *node = reinterpret_cast<slnode *>(mem);
+    node->key    = key;
+    node->type   = type;
+    node->height = height;
+    new (&node->val) std::atomic<const slvalue *>(v);
+    for (int i = 0; i < height; ++i)
+        new (&node->nxt[i]) std::atomic<slnode *>(nullptr);
+    return node;
+}
+
+/**
+ * 新版本整个写好再换上去，返回旧 value 的长度.
+ * 旧版本在 snapshot 时可见就接在新版本后面，否则跳过它（更早的版本原样保留），字节随 Arena 一起释放。
+ * 同一个 key 只有一个写者，读旧值和换上去之间不会有别人改这个节点。
+ */
+uint32_t skiplist::setValue(slnode *node, const std::string &val, uint64_t seq, uint64_t snapshot) {
+    char *mem;
+    {
+        std::lock_guard<std::mutex> lock(arenaMtx);
+        mem = arena.allocate(valueSize(val.size()));
+        memUsage.store(arena.memoryUsage(), std::memory_order_relaxed);
+    }
+    const slvalue *old  = node->val.load(std::memory_order_acquire);
+    const slvalue *prev = snapshot != 0 && old->seq <= snapshot ? old : old->prev;
+    node->val.store(newValue(val, seq, prev, mem), std::memory_order_release);
+    bytes.fetch_add(uint32_t(val.size() - old->len), std::memory_order_relaxed); // 变短时按模 2^32 回绕，等于减去差值
+    return old->len;
+}
+
 double skiplist::my_rand() {
-    return static_cast<double>(rand()) / RAND_MAX;
+    thread_local std::mt19937 rng(std::random_device{}()); // 每个写者一个，不用抢 rand() 的锁
+    return std::uniform_real_distribution<double>(0, 1)(rng);
 }
 
 int skiplist::randLevel() {
@@ -13,55 +75,81 @@ int skiplist::randLevel() {
     return level;
 }
 
-void skiplist::insert(uint64_t key, const std::string &val) {
-    std::vector<slnode *> update(MAX_LEVEL, nullptr);
-    slnode *current = head;
+/* 返回第 0 层走到的那个节点，不能再读一次 current->nxt[0]：期间可能插进来一个更小的 key */
+slnode *skiplist::findGreaterOrEqual(uint64_t key) const {
+    slnode *current = head, *next = tail;
+    for (int i = curMaxL.load(std::memory_order_relaxed) - 1; i >= 0; i--) {
+        next = current->nxt[i].load(std::memory_order_acquire);
+        while (next != tail && next->key < key) {
+            current = next;
+            next    = current->nxt[i].load(std::memory_order_acquire);
+        }
+    }
+    return next;
+}
 
-    // 查找插入位置
-    for (int i = curMaxL - 1; i >= 0; i--) {
-        while (current->nxt[i] != tail && current->nxt[i]->key < key) {
-            current = current->nxt[i];
+/* 从 before 开始在第 level 层找 key 的插入位置：prev->key < key <= next->key */
+void skiplist::findSplice(uint64_t key, slnode *before, int level, slnode *&prev, slnode *&next) const {
+    while (true) {
+        slnode *x = before->nxt[level].load(std::memory_order_acquire);
+        if (x == tail || x->key >= key) {
+            prev = before;
+            next = x;
+            return;
         }
-        update[i] = current;
+        before = x;
     }
+}
 
-    // 检查是否已存在
-    if (current->nxt[0] != tail && current->nxt[0]->key == key) {
-        current->nxt[0]->val = val;
-        return;
+int64_t skiplist::upsert(uint64_t key, const std::string &val, uint64_t seq, uint64_t snapshot) {
+    slnode *prev[MAX_LEVEL], *next[MAX_LEVEL];
+    int maxL       = curMaxL.load(std::memory_order_relaxed);
+    slnode *before = head;
+
+    // 查找插入位置
+    for (int i = maxL - 1; i >= 0; i--) {
+        findSplice(key, before, i, prev[i], next[i]);
+        before = prev[i];
     }
 
-    // 生成新节点层数
+    // 检查是否已存在
+    if (next[0] != tail && next[0]->key == key)
+        return setValue(next[0], val, seq, snapshot);
+
+    // 生成新节点层数，更高的层从 head 开始，接入时 CAS 失败会重新找
     int newLevel = randLevel();
-    if (newLevel > curMaxL) {
-        for (int i = curMaxL; i < newLevel; i++) {
-            update[i] = head;
-        }
-        curMaxL = newLevel;
+    for (int i = maxL; i < newLevel; i++) {
+        prev[i] = head;
+        next[i] = tail;
+    }
+    while (newLevel > maxL && !curMaxL.compare_exchange_weak(maxL, newLevel, std::memory_order_relaxed)) {
     }
 
-    // 创建新节点并更新指针
-    slnode *newNode = new slnode(key, val, NORMAL);
+    // 创建新节点，从下往上逐层接入
+    slnode *node = newNode(key, val, seq, NORMAL, newLevel, true);
     for (int i = 0; i < newLevel; i++) {
-        newNode->nxt[i]   = update[i]->nxt[i];
-        update[i]->nxt[i] = newNode;
+        while (true) {
+            node->nxt[i].store(next[i], std::memory_order_relaxed);
+            if (prev[i]->nxt[i].compare_exchange_strong(next[i], node, std::memory_order_release))
+                break;
+            findSplice(key, prev[i], i, prev[i], next[i]); // 有别的写者插在了这里
+            if (i == 0 && next[0] != tail && next[0]->key == key)
+                return setValue(next[0], val, seq, snapshot); // 同一个 key 被别的写者先插入了，新节点还没接入任何一层
+        }
     }
 
     // 更新字节数
-    bytes += sizeof(key) + val.size();
-    s++;
+    bytes.fetch_add(sizeof(key) + val.size(), std::memory_order_relaxed);
+    s.fetch_add(1, std::memory_order_relaxed);
+    return -1;
 }
 
-std::string skiplist::search(uint64_t key) {
-    slnode *current = head;
-    for (int i = curMaxL - 1; i >= 0; i--) {
-        while (current->nxt[i] != tail && current->nxt[i]->key < key) {
-            current = current->nxt[i];
-        }
-    }
-    current = current->nxt[0];
+std::string skiplist::search(uint64_t key, uint64_t seq) {
+    slnode *current = findGreaterOrEqual(key);
     if (current != tail && current->key == key) {
-        return current->val;
+        const slvalue *v = current->version(seq);
+        if (v != nullptr)
+            return std::string(v->data, v->len);
     }
     return "";
 }
@@ -69,10 +157,11 @@ std::string skiplist::search(uint64_t key) {
 bool skiplist::del(uint64_t key, uint32_t len) {
     std::vector<slnode *> update(MAX_LEVEL, nullptr);
     slnode *current = head;
+    int maxL        = curMaxL.load();
 
     // 查找删除位置
-    for (int i = curMaxL - 1; i >= 0; i--) {
-        while (current->nxt[i] != tail && current->nxt[i]->key < key) {
+    for (int i = maxL - 1; i >= 0; i--) {
+        while (current->nxt[i] != tail && current->nxt[i].load()->key < key) {
             current = current->nxt[i];
         }
         update[i] = current;
@@ -85,28 +174,27 @@ bool skiplist::del(uint64_t key, uint32_t len) {
     }
 
     // 删除 len 个节点
-    int count = 0;
+    uint32_t count = 0;
     while (current != tail && count < len) {
         slnode *tmp = current;
-        // 更新前驱指针
-        for (int i = 0; i < curMaxL; i++) {
+        // 更新前驱指针；节点的内存留在 Arena 里，reset 时一起释放
+        for (int i = 0; i < maxL && i < int(current->height); i++) {
             if (update[i]->nxt[i] == current) {
-                update[i]->nxt[i] = current->nxt[i];
+                update[i]->nxt[i] = current->nxt[i].load();
             }
         }
         current = current->nxt[0];
         // 更新字节数
-        bytes -= sizeof(tmp->key) + tmp->val.size();
+        bytes -= sizeof(tmp->key) + tmp->value().size();
         s--;
-
-        delete tmp;
         count++;
     }
 
     // 更新 curMaxL
-    while (curMaxL > 1 && head->nxt[curMaxL - 1] == tail) {
-        curMaxL--;
+    while (maxL > 1 && head->nxt[maxL - 1] == tail) {
+        maxL--;
     }
+    curMaxL = maxL;
 
     return true;
 }
@@ -114,38 +202,25 @@ bool skiplist::del(uint64_t key, uint32_t len) {
 void skiplist::scan(
     uint64_t key1,
     uint64_t key2,
-    std::vector<std::pair<uint64_t, std::string>> &list
+    std::vector<std::pair<uint64_t, std::string>> &list,
+    uint64_t seq
 ) {
-    slnode *current = head;
-    for (int i = curMaxL - 1; i >= 0; i--) {
-        while (current->nxt[i] != tail && current->nxt[i]->key < key1) {
-            current = current->nxt[i];
-        }
-    }
-    current = current->nxt[0];
+    slnode *current = findGreaterOrEqual(key1);
     while (current != tail && current->key <= key2) {
-        list.push_back(std::make_pair(current->key, current->val));
-        current = current->nxt[0];
+        const slvalue *v = current->version(seq);
+        if (v != nullptr)
+            list.emplace_back(current->key, std::string(v->data, v->len));
+        current = current->nxt[0].load(std::memory_order_acquire);
     }
 }
 
 slnode *skiplist::lowerBound(uint64_t key) {
-    slnode *current = head;
-    for (int i = curMaxL - 1; i >= 0; i--) {
-        while (current->nxt[i] != tail && current->nxt[i]->key < key) {
-            current = current->nxt[i];
-        }
-    }
-    return current->nxt[0];
+    return findGreaterOrEqual(key);
 }
 
 void skiplist::reset() {
-    slnode *current = head->nxt[0];
-    while (current != tail) {
-        slnode *tmp = current;
-        current = current->nxt[0];
-        delete tmp;
-    }
+    arena.reset();
+    memUsage = 0;
 
     // 重置参数
     s = 1;
@@ -157,5 +232,5 @@ void skiplist::reset() {
 }
 
 uint32_t skiplist::getBytes() {
-    return bytes;
+    return bytes.load(std::memory_order_relaxed);
 }
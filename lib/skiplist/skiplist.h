@@ -1,11 +1,15 @@
 #ifndef LSM_KV_SKIPLIST_H
 #define LSM_KV_SKIPLIST_H
 
+#include "arena.h"
+
+#include <atomic>
 #include <cstdint>
-#include <ctime>
 #include <limits>
 #include <list>
+#include <mutex>
 #include <string>
+#include <string_view>
 #include <vector>
 
 enum TYPE {
@@ -15,63 +19,117 @@ enum TYPE {
 };
 
 const int MAX_LEVEL = 18;
+const uint64_t MAX_SEQ = std::numeric_limits<uint64_t>::max(); // 读最新版本
+
+/* 一个版本的 value，从 Arena 分配，发布之后不再修改；prev 指向同一个 key 更旧的版本 */
+struct slvalue {
+    uint64_t seq;
+    const slvalue *prev;
+    uint32_t len;
+    char data[1];
+};
 
+/**
+ * 跳表节点，整个节点（含指针塔和第一个 value）从 Arena 中一次分配:
+ *   key | type | height | val | nxt[height] | slvalue
+ * nxt 按节点实际高度分配，不能访问 nxt[height] 及之后。
+ * 更新 value 时另外分配一个 slvalue 再原子地换上去，正在读旧 value 的读者不受影响。
+ * 还有快照要读的旧版本挂在新版本的 prev 上，按 seq 从新到旧排列。
+ */
 class slnode {
 public:
     uint64_t key;
-    std::string val;
     TYPE type;
-    std::vector<slnode *> nxt;
+    uint32_t height;
+    std::atomic<const slvalue *> val;
+    std::atomic<slnode *> nxt[1];
 
-    slnode(uint64_t key, const std::string &val, TYPE type) {
-        this->key  = key;
-        this->val  = val;
-        this->type = type;
-        for (int i = 0; i < MAX_LEVEL; ++i)
-            nxt.push_back(nullptr);
+    std::string_view value() const {
+        const slvalue *v = val.load(std::memory_order_acquire);
+        return std::string_view(v->data, v->len);
+    }
+
+    /* seq 及之前写入的最新版本，这个 key 在 seq 时还不存在则返回 nullptr */
+    const slvalue *version(uint64_t seq) const {
+        const slvalue *v = val.load(std::memory_order_acquire);
+        while (v != nullptr && v->seq > seq)
+            v = v->prev;
+        return v;
     }
 };
 
+/**
+ * 并发跳表 memtable，仿照 LevelDB/RocksDB 的 InlineSkipList.
+ *
+ * - upsert 只遍历一次，找到相同的 key 就换上新的 value，否则插入新节点；
+ *   可以多个线程同时调用：每一层用 CAS 把新节点接到前驱后面，
+ *   失败就从原来的前驱往后重新找这一层的位置，节点从下往上逐层接入；
+ * - 同一个 key 的写入由调用者保证不并发（single writer per key），
+ *   否则两个写者谁的 value 留下来是不确定的；
+ * - 每次写入带一个 seq，search/scan 可以只看 seq 及之前的版本；
+ *   覆盖时旧版本的 seq <= snapshot（最新的存活快照）才保留，没有快照时和原地覆盖一样；
+ * - search/scan/lowerBound 不加锁，和 upsert 可以同时进行；
+ * - del 和 reset 要求没有其他线程在访问这个跳表。
+ */
 class skiplist {
 private:
     const uint64_t INF = std::numeric_limits<uint64_t>::max();
     double p;
-    uint64_t s     = 1;
-    uint32_t bytes = 0x0; // bytes表示index + data区域的字节数
-    int curMaxL    = 1;
-    slnode *head   = new slnode(0, "", HEAD);
-    slnode *tail   = new slnode(INF, "", TAIL);
+    std::atomic<uint64_t> s{1};
+    std::atomic<uint32_t> bytes{0}; // bytes表示index + data区域的字节数
+    std::atomic<int> curMaxL{1};
+    std::mutex arenaMtx; // Arena 本身不是线程安全的，分配很短，直接加锁
+    Arena arena;
+    std::atomic<size_t> memUsage{0}; // arena.memoryUsage() 的无锁副本，写者每次都要看
+    slnode *head;
+    slnode *tail;
+
+    slnode *newNode(uint64_t key, const std::string &val, uint64_t seq, TYPE type, int height, bool inArena);
+    const slvalue *newValue(const std::string &val, uint64_t seq, const slvalue *prev, char *mem);
+    uint32_t setValue(slnode *node, const std::string &val, uint64_t seq, uint64_t snapshot);
+    slnode *findGreaterOrEqual(uint64_t key) const; // 第一个 key >= key 的节点
+    void findSplice(uint64_t key, slnode *before, int level, slnode *&prev, slnode *&next) const;
 
 public:
     skiplist(double p) { // p 表示增长概率
-        s       = 1;
-        bytes   = 0x0;
-        curMaxL = 1;
         this->p = p;
+        head    = newNode(0, "", 0, HEAD, MAX_LEVEL, false);
+        tail    = newNode(INF, "", 0, TAIL, MAX_LEVEL, false);
         for (int i = 0; i < MAX_LEVEL; ++i)
-            head->nxt[i] = tail;
+            head->nxt[i].store(tail, std::memory_order_relaxed);
+    }
 
-        // set random seed
-        srand(time(nullptr));
+    ~skiplist() {
+        delete[] reinterpret_cast<char *>(head);
+        delete[] reinterpret_cast<char *>(tail);
     }
 
+    skiplist(const skiplist &) = delete;
+    skiplist &operator=(const skiplist &) = delete;
+
     slnode *getFirst() {
-        return head->nxt[0];
+        return head->nxt[0].load(std::memory_order_acquire);
     }
 
     double my_rand();
     int randLevel();
-    void insert(uint64_t key, const std::string &str);
-    std::string search(uint64_t key);
+    // 插入或更新，返回旧 value 的长度，新 key 返回 -1；snapshot 为 0 表示没有快照
+    int64_t upsert(uint64_t key, const std::string &str, uint64_t seq = 0, uint64_t snapshot = 0);
+    std::string search(uint64_t key, uint64_t seq = MAX_SEQ); // seq 及之前的最新版本
     bool del(uint64_t key, uint32_t len);
     void scan(
         uint64_t key1,
         uint64_t key2,
-        std::vector<std::pair<uint64_t, std::string>> &list
+        std::vector<std::pair<uint64_t, std::string>> &list,
+        uint64_t seq = MAX_SEQ // seq 时还不存在的 key 不输出
     );
     slnode *lowerBound(uint64_t key);
-    void reset();
+    void reset(); // 整个 Arena 一次释放
     uint32_t getBytes();
+
+    size_t getMemoryUsage() { // 节点实际占用的内存
+        return memUsage.load(std::memory_order_relaxed);
+    }
 };
 
 #endif // LSM_KV_SKIPLIST_H
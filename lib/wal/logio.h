@@ -0,0 +1,11 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/* WAL 和 MANIFEST 共用的日志记录工具 */
+namespace logio {
+uint32_t crc32(const char *data, size_t n);   // 标准 CRC-32（多项式 0xEDB88320）
+bool writeAll(int fd, const std::string &data); // 写完整个 data，被信号打断就继续；出错返回 false
+} // namespace logio
@@ -0,0 +1,159 @@
+#pragma once
+
+#include <sstream>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <vector>
+
+#ifdef _WIN32
+#include <direct.h>
+#include <io.h>
+#include <stdio.h>
+#include <windows.h>
+#endif
+#if defined(__linux__) || defined(__MINGW32__) || defined(__APPLE__)
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace utils {
+/**
+ * Check whether directory exists
+ * @param path directory to be checked.
+ * @return ture if directory exists, false otherwise.
+ */
+static inline bool dirExists(std::string path) {
+    struct stat st;
+    int ret = stat(path.c_str(), &st);
+    return ret == 0 && st.st_mode & S_IFDIR;
+}
+
+/**
+ * list all filename in a directory
+ * @param path directory path.
+ * @param ret all files name in directory.
+ * @return files number.
+ */
+#if defined(_WIN32) && !defined(__MINGW32__)
+static inline int scanDir(std::string path, std::vector<std::string> &ret) {
+    std::string extendPath;
+    if (path[path.size() - 1] == '/') {
+        extendPath = path + "*";
+    } else {
+        extendPath = path + "/*";
+    }
+    WIN32_FIND_DATAA fd;
+    HANDLE h = FindFirstFileA(extendPath.c_str(), &fd);
+    if (h == INVALID_HANDLE_VALUE) {
+        return 0;
+    }
+    while (true) {
+        std::string ss(fd.cFileName);
+        if (ss[0] != '.') {
+            ret.push_back(ss);
+        }
+        if (FindNextFile(h, &fd) == false) {
+            break;
+        }
+    }
+    FindClose(h);
+    return ret.size();
+}
+#endif
+#if defined(__linux__) || defined(__MINGW32__) || defined(__APPLE__)
+static inline int scanDir(std::string path, std::vector<std::string> &ret) {
+    DIR *dir;
+    struct dirent *rent;
+    dir = opendir(path.c_str());
+    char s[100];
+    while ((rent = readdir(dir))) {
+        strcpy(s, rent->d_name);
+        if (s[0] != '.') {
+            ret.push_back(s);
+        }
+    }
+    closedir(dir);
+    return ret.size();
+}
+#endif
+
+/**
+ * Create directory
+ * @param path directory to be created.
+ * @return 0 if directory is created successfully, -1 otherwise.
+ */
+static inline int _mkdir(const char *path) {
+#ifdef _WIN32
+    return ::_mkdir(path);
+#else
+    return ::mkdir(path, 0775);
+#endif
+}
+
+/**
+ * Create directory recursively
+ * @param path directory to be created.
+ * @return 0 if directory is created successfully, -1 otherwise.
+ */
+static inline int mkdir(const char *path) {
+    std::string currentPath = "";
+    std::string dirName;
+    std::stringstream ss(path);
+
+    while (std::getline(ss, dirName, '/')) {
+        currentPath += dirName;
+        if (!dirExists(currentPath) && _mkdir(currentPath.c_str()) != 0) {
+            return -1;
+        }
+        currentPath += "/";
+    }
+    return 0;
+}
+
+/**
+ * Delete a empty directory
+ * @param path directory to be deleted.
+ * @return 0 if delete successfully, -1 otherwise.
+ */
+static inline int rmdir(const char *path) {
+#ifdef _WIN32
+    return ::_rmdir(path);
+#else
+    return ::rmdir(path);
+#endif
+}
+
+/**
+ * Delete a file
+ * @param path file to be deleted.
+ * @return 0 if delete successfully, -1 otherwise.
+ */
+static inline int rmfile(const char *path) {
+#ifdef _WIN32
+    return ::_unlink(path);
+#else
+    return ::unlink(path);
+#endif
+}
+
+/**
+ * Flush a directory's entries (files created or renamed in it) to disk
+ * @param path directory to be synced.
+ * @return 0 if synced successfully, -1 otherwise.
+ */
+static inline int syncDir(const char *path) {
+#ifdef _WIN32
+    return 0;
+#else
+    int fd = ::open(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0)
+        return -1;
+    int ret = ::fsync(fd);
+    ::close(fd);
+    return ret;
+#endif
+}
+
+} // namespace utils
@@ -0,0 +1,221 @@
+#include "wal.h"
+
+#include "logio.h"
+#include "utils/utils.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fcntl.h>
+#include <stdexcept>
+#include <vector>
+
+static std::string encodeRecord(uint64_t key, const std::string &val) {
+    uint32_t len = val.length();
+    std::string rec(4 + 8 + 4 + len, '\0');
+    memcpy(&rec[4], &key, 8);
+    memcpy(&rec[12], &len, 4);
+    memcpy(&rec[16], val.data(), len);
+    uint32_t crc = logio::crc32(rec.data() + 4, rec.size() - 4);
+    memcpy(&rec[0], &crc, 4);
+    return rec;
+}
+
+/* 目录下所有日志的编号，升序 */
+static std::vector<uint64_t> listLogs(const std::string &dir) {
+    std::vector<std::string> files;
+    std::vector<uint64_t> res;
+    utils::scanDir(dir, files);
+    for (auto &file : files) {
+        size_t dot = file.find(".log");
+        if (dot == std::string::npos || dot == 0)
+            continue;
+        res.push_back(std::stoull(file.substr(0, dot)));
+    }
+    std::sort(res.begin(), res.end());
+    return res;
+}
+
+WAL::WAL(const std::string &dir, WalSyncMode mode, uint32_t syncIntervalMs) :
+    dir(dir),
+    mode(mode),
+    syncIntervalMs(syncIntervalMs) {
+    if (!utils::dirExists(dir))
+        utils::mkdir(dir.data());
+
+    /* 旧日志留给 replay，新写入从一个新文件开始 */
+    std::vector<uint64_t> logs = listLogs(dir);
+    openLog(logs.empty() ? 1 : logs.back() + 1);
+
+    if (mode == WAL_SYNC_INTERVAL)
+        syncer = std::thread(&WAL::syncLoop, this);
+}
+
+WAL::~WAL() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stop = true;
+    }
+    stopCv.notify_all();
+    if (syncer.joinable())
+        syncer.join();
+    try {
+        sync();
+    } catch (const std::runtime_error &) {
+        // 析构不能抛异常，失败之前的写入已经报过错
+    }
+    closeLog();
+}
+
+std::string WAL::logPath(uint64_t number) const {
+    return dir + "/" + std::to_string(number) + ".log";
+}
+
+void WAL::openLog(uint64_t number) {
+    std::string path = logPath(number);
+    fd               = ::open(path.data(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd < 0)
+        throw std::runtime_error("open wal failed");
+    if (utils::syncDir(dir.data()) != 0)
+        throw std::runtime_error("sync wal failed");
+    logNumber = number;
+    dirty     = false;
+}
+
+void WAL::closeLog() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+void WAL::append(uint64_t key, const std::string &val) {
+    Writer w;
+    w.rec = encodeRecord(key, val);
+
+    std::unique_lock<std::mutex> lock(mtx);
+    if (failed)
+        throw std::runtime_error("sync wal failed");
+    writers.push_back(&w);
+    while (!w.done && (writers.front() != &w || writing))
+        w.cv.wait(lock);
+    if (w.failed)
+        throw std::runtime_error("write wal failed");
+    if (w.done)
+        return; // 已被其他 leader 顺带写入
+
+    /* 成为 leader，把队列里已有的记录一次写完 */
+    std::string batch;
+    size_t n = writers.size();
+    for (size_t i = 0; i < n; ++i)
+        batch += writers[i]->rec;
+    writing = true;
+    int cur = fd;
+    lock.unlock();
+
+    bool ok = logio::writeAll(cur, batch) && (mode != WAL_SYNC_BATCH || ::fdatasync(cur) == 0);
+
+    /* 失败时也要放开 writing 并唤醒整批，否则其他线程会一直等下去 */
+    lock.lock();
+    writing = false;
+    dirty   = (mode != WAL_SYNC_BATCH);
+    failed  = failed || !ok; // 写了一半的记录会挡住之后的重放，不能再接着写
+    for (size_t i = 0; i < n; ++i) {
+        Writer *x = writers.front();
+        writers.pop_front();
+        x->done   = true;
+        x->failed = !ok;
+        if (x != &w)
+            x->cv.notify_one();
+    }
+    if (!writers.empty())
+        writers.front()->cv.notify_one();
+    syncCv.notify_all();
+    if (!ok)
+        throw std::runtime_error("write wal failed");
+}
+
+void WAL::replay(const std::function<void(uint64_t, const std::string &)> &apply) {
+    for (uint64_t number : listLogs(dir)) {
+        if (number >= logNumber)
+            break;
+        FILE *file = fopen(logPath(number).data(), "rb");
+        if (file == nullptr)
+            continue;
+        std::string data;
+        char chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+            data.append(chunk, n);
+        fclose(file);
+
+        size_t pos = 0;
+        while (pos + 16 <= data.size()) {
+            uint32_t crc, len;
+            uint64_t key;
+            memcpy(&crc, &data[pos], 4);
+            memcpy(&key, &data[pos + 4], 8);
+            memcpy(&len, &data[pos + 12], 4);
+            if (pos + 16 + len > data.size() || logio::crc32(&data[pos + 4], 12 + len) != crc)
+                break; // 崩溃时写了一半的尾部，丢弃
+            apply(key, data.substr(pos + 16, len));
+            pos += 16 + len;
+        }
+    }
+}
+
+uint64_t WAL::rotate() {
+    std::unique_lock<std::mutex> lock(mtx);
+    syncCv.wait(lock, [this] { return !writing; });
+    /* 旧日志关闭之后 syncLoop 不会再同步它，切换前先把没落盘的部分 fdatasync 掉 */
+    if (fd >= 0 && dirty && ::fdatasync(fd) != 0)
+        failed = true;
+    uint64_t old = logNumber;
+    closeLog();
+    openLog(old + 1);
+    return old;
+}
+
+void WAL::removeUpTo(uint64_t number) {
+    for (uint64_t it : listLogs(dir)) {
+        if (it > number)
+            break;
+        utils::rmfile(logPath(it).data());
+    }
+}
+
+void WAL::reset() {
+    std::unique_lock<std::mutex> lock(mtx);
+    syncCv.wait(lock, [this] { return !writing; });
+    uint64_t next = logNumber + 1;
+    closeLog();
+    for (uint64_t it : listLogs(dir))
+        utils::rmfile(logPath(it).data());
+    openLog(next);
+}
+
+void WAL::sync() {
+    std::unique_lock<std::mutex> lock(mtx);
+    syncCv.wait(lock, [this] { return !writing; });
+    if (fd >= 0 && dirty) {
+        if (::fdatasync(fd) != 0)
+            failed = true;
+        dirty = false;
+    }
+    if (failed)
+        throw std::runtime_error("sync wal failed");
+}
+
+void WAL::syncLoop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!stop) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(syncIntervalMs);
+        if (stopCv.wait_until(lock, deadline, [this] { return stop; }))
+            break;
+        if (writing || !dirty)
+            continue;
+        /* 持锁 fdatasync，保证 rotate 不会关闭正在同步的 fd；失败时留给下一次 append/sync 报错 */
+        if (::fdatasync(fd) != 0)
+            failed = true;
+        dirty = false;
+    }
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/* WAL 落盘策略 */
+enum WalSyncMode {
+    WAL_NO_SYNC,       // 只 write 到内核缓冲区，进程崩溃不丢数据，掉电可能丢
+    WAL_SYNC_INTERVAL, // 后台线程每 N ms fdatasync 一次
+    WAL_SYNC_BATCH     // 每个 group commit 批次都 fdatasync
+};
+
+/**
+ * memtable 的预写日志，只追加.
+ *
+ * 日志文件放在 dir 下，名为 <编号>.log，每条记录为
+ *   uint32_t crc | uint64_t key | uint32_t len | char val[len]
+ * crc 覆盖 key、len 和 val，重放时能发现崩溃时写了一半的尾部。
+ * 并发的 append 合成一批：排在队首的写者作为 leader，把队列里所有记录一次写入（按需 fdatasync）。
+ */
+class WAL {
+public:
+    WAL(const std::string &dir, WalSyncMode mode = WAL_SYNC_INTERVAL, uint32_t syncIntervalMs = 100);
+
+    ~WAL();
+
+    void append(uint64_t key, const std::string &val);
+
+    /* 按日志编号从小到大重放所有记录 */
+    void replay(const std::function<void(uint64_t, const std::string &)> &apply);
+
+    uint64_t rotate();                // 切换到新的日志文件，返回旧文件编号
+    void removeUpTo(uint64_t number); // 删除编号 <= number 的日志
+    void reset();                     // 删除全部日志并重新开始
+    void sync();
+
+    uint64_t getLogNumber() const {
+        return logNumber;
+    }
+
+private:
+    struct Writer {
+        std::string rec;
+        bool done   = false;
+        bool failed = false; // 所在批次写入或 fdatasync 失败
+        std::condition_variable cv;
+    };
+
+    std::string logPath(uint64_t number) const;
+    void openLog(uint64_t number);
+    void closeLog();
+    void syncLoop();
+
+private:
+    std::string dir;
+    WalSyncMode mode;
+    uint32_t syncIntervalMs;
+
+    int fd             = -1;
+    uint64_t logNumber = 0;
+    bool dirty         = false; // 有尚未 fdatasync 的数据
+    bool failed        = false; // 写入或 fdatasync 失败过，之后的写入一律报错
+
+    std::mutex mtx;
+    std::deque<Writer *> writers; // 等待写入的队列，队首为 leader
+    bool writing = false;         // leader 正在无锁写盘
+
+    std::condition_variable syncCv; // leader 写完时通知 rotate/sync
+
+    bool stop = false;
+    std::condition_variable stopCv;
+    std::thread syncer;
+};
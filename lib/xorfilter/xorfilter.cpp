@@ -0,0 +1,172 @@
+#include "xorfilter.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const int ARITY          = 3;
+static const int MAX_ITERATIONS = 100; // 换 seed 重试的次数，正常情况下一两次就能建成
+
+static inline uint64_t murmur64(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static inline uint64_t splitmix64(uint64_t &state) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ull);
+    z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+    z          = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+    return z ^ (z >> 31);
+}
+
+static inline uint64_t mulhi(uint64_t a, uint64_t b) {
+    return (static_cast<unsigned __int128>(a) * b) >> 64;
+}
+
+static inline uint8_t fingerprint(uint64_t hash) {
+    return hash ^ (hash >> 32);
+}
+
+static inline uint32_t mod3(uint32_t x) {
+    return x > 2 ? x - 3 : x;
+}
+
+/* 三个位置分别落在相邻的三个 segment 里 */
+void xorFilter::hashes(uint64_t hash, uint32_t h[3]) const {
+    h[0] = mulhi(hash, segmentCountLength);
+    h[1] = h[0] + segmentLength;
+    h[2] = h[1] + segmentLength;
+    h[1] ^= (hash >> 18) & segmentLengthMask;
+    h[2] ^= hash & segmentLengthMask;
+}
+
+/**
+ * 建表：每个位置记下落在它上面的 key 数和这些 key 哈希的异或，
+ * 反复摘掉只被一个 key 占用的位置（peeling），全部摘完后按相反的顺序填指纹。
+ * 摘不完说明哈希出现了环，换一个 seed 重来。
+ */
+xorFilter::xorFilter(std::vector<uint64_t> keys) {
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    uint32_t n = keys.size();
+    if (n == 0)
+        return;
+
+    // segment 长度和总容量随 key 数变化，key 少时需要更多的冗余才容易建成
+    segmentLength     = std::min<uint32_t>(1u << static_cast<int>(std::log(n) / std::log(3.33) + 2.25), 1u << 18);
+    segmentLengthMask = segmentLength - 1;
+    double sizeFactor = n <= 1 ? 0 : std::max(1.125, 0.875 + 0.25 * std::log(1000000.0) / std::log(n));
+    int64_t capacity  = std::llround(n * sizeFactor);
+    int64_t segmentCount = std::max<int64_t>((capacity + segmentLength - 1) / segmentLength - (ARITY - 1), 1);
+    uint32_t arrayLength = (segmentCount + ARITY - 1) * segmentLength;
+    segmentCountLength   = segmentCount * segmentLength;
+
+    std::vector<uint8_t> count(arrayLength); // 高 6 位是 key 数，低 2 位是这些 key 在此处用的第几个哈希的异或
+    std::vector<uint64_t> xorHash(arrayLength);
+    std::vector<uint32_t> alone(arrayLength);
+    std::vector<uint64_t> order(n);
+    std::vector<uint8_t> orderH(n);
+
+    uint64_t rng = 0x726b2b9d438b9d4dull;
+    for (int iter = 0; iter < MAX_ITERATIONS; ++iter) {
+        seed = splitmix64(rng);
+        std::fill(count.begin(), count.end(), 0);
+        std::fill(xorHash.begin(), xorHash.end(), 0);
+
+        bool overflow = false;
+        for (uint64_t key : keys) {
+            uint64_t hash = murmur64(key + seed);
+            uint32_t h[3];
+            hashes(hash, h);
+            for (uint32_t i = 0; i < 3; ++i) {
+                count[h[i]] += 4;
+                count[h[i]] ^= i;
+                xorHash[h[i]] ^= hash;
+                overflow |= count[h[i]] < 4; // 超过 63 个 key 落在同一处
+            }
+        }
+        if (overflow)
+            continue;
+
+        uint32_t queued = 0, peeled = 0;
+        for (uint32_t i = 0; i < arrayLength; ++i) {
+            if ((count[i] >> 2) == 1)
+                alone[queued++] = i;
+        }
+        while (queued > 0) {
+            uint32_t index = alone[--queued];
+            if ((count[index] >> 2) != 1)
+                continue;
+            uint64_t hash  = xorHash[index];
+            uint32_t found = count[index] & 3;
+            order[peeled]  = hash;
+            orderH[peeled] = found;
+            ++peeled;
+
+            uint32_t h[3];
+            hashes(hash, h);
+            for (uint32_t k = 1; k < 3; ++k) {
+                uint32_t other = h[mod3(found + k)];
+                if ((count[other] >> 2) == 2)
+                    alone[queued++] = other;
+                count[other] -= 4;
+                count[other] ^= mod3(found + k);
+                xorHash[other] ^= hash;
+            }
+        }
+        if (peeled < n)
+            continue;
+
+        fingerprints.assign(arrayLength, 0);
+        for (uint32_t i = n; i-- > 0;) {
+            uint32_t h[3];
+            hashes(order[i], h);
+            uint32_t found = orderH[i];
+            fingerprints[h[found]] =
+                fingerprint(order[i]) ^ fingerprints[h[mod3(found + 1)]] ^ fingerprints[h[mod3(found + 2)]];
+        }
+        return;
+    }
+    // 建不成时留空：空的 filter 不排除任何 key，不影响正确性
+}
+
+bool xorFilter::search(uint64_t key) const {
+    if (fingerprints.empty())
+        return true;
+    uint64_t hash = murmur64(key + seed);
+    uint32_t h[3];
+    hashes(hash, h);
+    return (fingerprint(hash) ^ fingerprints[h[0]] ^ fingerprints[h[1]] ^ fingerprints[h[2]]) == 0;
+}
+
+void xorFilter::encode(std::string &dst) const {
+    if (fingerprints.empty())
+        return;
+    uint32_t arrayLength = fingerprints.size();
+    dst.append(reinterpret_cast<const char *>(&seed), 8);
+    dst.append(reinterpret_cast<const char *>(&segmentLength), 4);
+    dst.append(reinterpret_cast<const char *>(&segmentCountLength), 4);
+    dst.append(reinterpret_cast<const char *>(&arrayLength), 4);
+    dst.append(reinterpret_cast<const char *>(fingerprints.data()), arrayLength);
+}
+
+bool xorFilter::decode(const char *src, size_t n) {
+    fingerprints.clear();
+    if (n < HEADER_SIZE)
+        return false;
+    uint32_t arrayLength;
+    memcpy(&seed, src, 8);
+    memcpy(&segmentLength, src + 8, 4);
+    memcpy(&segmentCountLength, src + 12, 4);
+    memcpy(&arrayLength, src + 16, 4);
+    if (n != HEADER_SIZE + arrayLength || segmentLength == 0 || (segmentLength & (segmentLength - 1)) ||
+        segmentCountLength + 2ull * segmentLength > arrayLength)
+        return false;
+    segmentLengthMask = segmentLength - 1;
+    fingerprints.assign(src + HEADER_SIZE, src + n);
+    return true;
+}
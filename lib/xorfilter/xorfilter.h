@@ -0,0 +1,44 @@
+#ifndef LSM_KV_XORFILTER_H
+#define LSM_KV_XORFILTER_H
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * 8 位指纹的 binary fuse filter（xor filter 的改进版），只能一次性由全部 key 建成.
+ *
+ * 每个 key 哈希到三个相邻 segment 中的各一个位置，三处指纹异或等于 key 的指纹即认为存在。
+ * 每个 key 约 9 位，误判率约 1/256，查询固定 3 次访存。没有建成（或没有 key）的 filter 不排除任何 key。
+ * 序列化格式：
+ *   uint64_t seed | uint32_t segmentLength | uint32_t segmentCountLength | uint32_t arrayLength
+ *   | uint8_t fingerprints[arrayLength]
+ */
+class xorFilter {
+private:
+    uint64_t seed               = 0;
+    uint32_t segmentLength      = 0;
+    uint32_t segmentLengthMask  = 0;
+    uint32_t segmentCountLength = 0;
+    std::vector<uint8_t> fingerprints;
+
+    void hashes(uint64_t hash, uint32_t h[3]) const;
+
+public:
+    static const uint32_t HEADER_SIZE = 20;
+
+    xorFilter() {}
+
+    explicit xorFilter(std::vector<uint64_t> keys); // 重复的 key 会被去掉
+
+    bool search(uint64_t key) const;
+
+    size_t size() const { // 序列化后的字节数
+        return fingerprints.empty() ? 0 : HEADER_SIZE + fingerprints.size();
+    }
+
+    void encode(std::string &dst) const;
+    bool decode(const char *src, size_t n); // 数据不完整返回 false
+};
+
+#endif // LSM_KV_XORFILTER_H
@@ -0,0 +1,237 @@
+#include "manifest.h"
+
+#include "logio.h"
+#include "utils.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <fcntl.h>
+#include <stdexcept>
+
+static const uint64_t MAX_MANIFEST_BYTES = 4 * 1024 * 1024; // 超过就重写成快照
+
+static void putU32(std::string &dst, uint32_t v) {
+    dst.append(reinterpret_cast<const char *>(&v), 4);
+}
+
+static void putU64(std::string &dst, uint64_t v) {
+    dst.append(reinterpret_cast<const char *>(&v), 8);
+}
+
+static void putStr(std::string &dst, const std::string &s) {
+    putU32(dst, s.length());
+    dst += s;
+}
+
+/* 按顺序解码 payload，越界时 ok 置为 false */
+struct Decoder {
+    const std::string &src;
+    size_t pos = 0;
+    bool ok    = true;
+
+    explicit Decoder(const std::string &src) : src(src) {}
+
+    void raw(void *dst, size_t n) {
+        if (!ok || pos + n > src.size()) {
+            ok = false;
+            return;
+        }
+        memcpy(dst, &src[pos], n);
+        pos += n;
+    }
+
+    uint32_t u32() {
+        uint32_t v = 0;
+        raw(&v, 4);
+        return v;
+    }
+
+    uint64_t u64() {
+        uint64_t v = 0;
+        raw(&v, 8);
+        return v;
+    }
+
+    std::string str() {
+        uint32_t len = u32();
+        if (!ok || pos + len > src.size()) {
+            ok = false;
+            return "";
+        }
+        pos += len;
+        return src.substr(pos - len, len);
+    }
+};
+
+static std::string encodeEdit(const VersionEdit &edit) {
+    std::string payload;
+    putU64(payload, edit.lastTime);
+    putU32(payload, edit.added.size());
+    for (const FileMeta &f : edit.added) {
+        putU32(payload, f.level);
+        putStr(payload, f.filename);
+        putU64(payload, f.time);
+        putU64(payload, f.cnt);
+        putU64(payload, f.minV);
+        putU64(payload, f.maxV);
+        putU32(payload, f.bytes);
+        putU32(payload, f.nameSuffix);
+    }
+    putU32(payload, edit.deleted.size());
+    for (const std::string &name : edit.deleted)
+        putStr(payload, name);
+
+    std::string rec;
+    putU32(rec, logio::crc32(payload.data(), payload.size()));
+    putU32(rec, payload.size());
+    return rec + payload;
+}
+
+static bool decodeEdit(const std::string &payload, VersionEdit &edit) {
+    Decoder in(payload);
+    edit.lastTime = in.u64();
+    uint32_t n    = in.u32();
+    for (uint32_t i = 0; in.ok && i < n; ++i) {
+        FileMeta f;
+        f.level      = in.u32();
+        f.filename   = in.str();
+        f.time       = in.u64();
+        f.cnt        = in.u64();
+        f.minV       = in.u64();
+        f.maxV       = in.u64();
+        f.bytes      = in.u32();
+        f.nameSuffix = in.u32();
+        edit.added.push_back(f);
+    }
+    n = in.u32();
+    for (uint32_t i = 0; in.ok && i < n; ++i)
+        edit.deleted.push_back(in.str());
+    return in.ok && in.pos == payload.size();
+}
+
+FileMeta::FileMeta(uint32_t level, sstablehead &head) :
+    level(level),
+    filename(head.getFilename()),
+    time(head.getTime()),
+    cnt(head.getCnt()),
+    minV(head.getMinV()),
+    maxV(head.getMaxV()),
+    bytes(head.getBytes()),
+    nameSuffix(head.getNameSuf()) {}
+
+void FileMeta::apply(sstablehead &head) const {
+    head.setFilename(filename);
+    head.setTime(time);
+    head.setCnt(cnt);
+    head.setMinV(minV);
+    head.setMaxV(maxV);
+    head.setBytes(bytes);
+    head.setNamesuffix(nameSuffix);
+}
+
+Manifest::Manifest(const std::string &dir) : dir(dir), path(dir + "/MANIFEST") {
+    if (!utils::dirExists(dir))
+        utils::mkdir(dir.data());
+}
+
+Manifest::~Manifest() {
+    closeLog();
+}
+
+void Manifest::closeLog() {
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+bool Manifest::load(std::vector<FileMeta> &files, uint64_t &lastTime) {
+    std::lock_guard<std::mutex> lock(mtx);
+    FILE *file = fopen(path.data(), "rb");
+    if (file == nullptr)
+        return false;
+    std::string data;
+    char chunk[65536];
+    size_t n;
+    while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0)
+        data.append(chunk, n);
+    fclose(file);
+
+    size_t pos = 0;
+    while (pos + 8 <= data.size()) {
+        uint32_t crc, len;
+        memcpy(&crc, &data[pos], 4);
+        memcpy(&len, &data[pos + 4], 4);
+        if (pos + 8 + len > data.size() || logio::crc32(&data[pos + 8], len) != crc)
+            break; // 崩溃时写了一半的尾部，丢弃
+        VersionEdit edit;
+        if (!decodeEdit(data.substr(pos + 8, len), edit))
+            throw std::runtime_error("corrupted manifest");
+        apply(edit);
+        pos += 8 + len;
+    }
+
+    rewrite(); // 压缩成一条快照，顺便截掉损坏的尾部
+    files.clear();
+    for (auto &it : live)
+        files.push_back(it.second);
+    lastTime = this->lastTime;
+    return true;
+}
+
+void Manifest::apply(const VersionEdit &edit) {
+    lastTime = std::max(lastTime, edit.lastTime);
+    for (const std::string &name : edit.deleted)
+        live.erase(name);
+    for (const FileMeta &f : edit.added)
+        live[f.filename] = f;
+}
+
+void Manifest::logEdit(const VersionEdit &edit) {
+    std::lock_guard<std::mutex> lock(mtx);
+    apply(edit);
+    if (fd < 0 || logBytes > MAX_MANIFEST_BYTES) {
+        rewrite(); // 快照里已经包含了这次修改
+        return;
+    }
+    std::string rec = encodeEdit(edit);
+    if (!logio::writeAll(fd, rec))
+        throw std::runtime_error("write manifest failed");
+    if (::fdatasync(fd) != 0)
+        throw std::runtime_error("sync manifest failed");
+    logBytes += rec.size();
+}
+
+void Manifest::reset() {
+    std::lock_guard<std::mutex> lock(mtx);
+    live.clear();
+    rewrite();
+}
+
+/* 把当前文件集合写成只有一条记录的新 MANIFEST，rename 保证替换是原子的 */
+void Manifest::rewrite() {
+    VersionEdit snapshot;
+    snapshot.lastTime = lastTime;
+    for (auto &it : live)
+        snapshot.added.push_back(it.second);
+    std::string rec = encodeEdit(snapshot);
+
+    std::string tmp = path + ".tmp";
+    int tmpFd       = ::open(tmp.data(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (tmpFd < 0)
+        throw std::runtime_error("open manifest failed");
+    bool ok = logio::writeAll(tmpFd, rec) && ::fdatasync(tmpFd) == 0;
+    ::close(tmpFd);
+    if (!ok)
+        throw std::runtime_error("write manifest failed");
+    if (::rename(tmp.data(), path.data()) != 0)
+        throw std::runtime_error("rename manifest failed");
+    if (utils::syncDir(dir.data()) != 0) // rename 本身也要落盘
+        throw std::runtime_error("sync manifest failed");
+
+    closeLog();
+    fd = ::open(path.data(), O_WRONLY | O_APPEND);
+    if (fd < 0)
+        throw std::runtime_error("open manifest failed");
+    logBytes = rec.size();
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#ifndef LSM_KV_MANIFEST_H
+#define LSM_KV_MANIFEST_H
+#include "sstablehead.h"
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/* 一个 sstable 的元数据，启动时不用读文件就能确定它在哪一层、覆盖哪些 key */
+struct FileMeta {
+    uint32_t level = 0;
+    std::string filename;
+    uint64_t time = 0, cnt = 0, minV = 0, maxV = 0;
+    uint32_t bytes = 0, nameSuffix = 0;
+
+    FileMeta() {}
+
+    FileMeta(uint32_t level, sstablehead &head);
+
+    void apply(sstablehead &head) const; // 把元数据填回 head，不含 bloom 和 index
+};
+
+/* 一次原子的文件集合变更：flush 增加一个 level-0 文件，合并删除输入、增加输出 */
+struct VersionEdit {
+    uint64_t lastTime = 0; // 目前为止用过的最大时间戳
+    std::vector<FileMeta> added;
+    std::vector<std::string> deleted;
+};
+
+/**
+ * MANIFEST：只追加的 VersionEdit 日志，记录当前存活的 sstable 集合.
+ *
+ * 每条记录为
+ *   uint32_t crc | uint32_t len | char payload[len]
+ * 载入时丢弃写了一半的尾部。内存里也保存一份文件集合，打开时和日志超过上限时
+ * 把它重写成只有一条快照记录的新文件（先写临时文件再 rename）。
+ */
+class Manifest {
+public:
+    explicit Manifest(const std::string &dir);
+
+    ~Manifest();
+
+    /* 重放日志得到当前的文件集合；没有 MANIFEST（新库或旧版本的库）返回 false */
+    bool load(std::vector<FileMeta> &files, uint64_t &lastTime);
+
+    void logEdit(const VersionEdit &edit); // 追加一条记录并 fdatasync
+    void reset();                          // 清空文件集合
+
+private:
+    void apply(const VersionEdit &edit);
+    void rewrite();
+    void closeLog();
+
+private:
+    std::string dir;
+    std::string path;
+
+    int fd            = -1;
+    uint64_t logBytes = 0; // 当前日志大小，超过上限就重写成快照
+
+    std::mutex mtx;
+    std::map<std::string, FileMeta> live; // filename -> meta
+    uint64_t lastTime = 0;
+};
+
+#endif // LSM_KV_MANIFEST_H
@@ -0,0 +1,95 @@
+#include "merger.h"
+
+#include <algorithm>
+
+void MemtableIterator::skipInvisible() {
+    for (; node->type != TAIL; node = node->nxt[0].load(std::memory_order_acquire)) {
+        val = node->version(seq);
+        if (val != nullptr)
+            return;
+    }
+    val = nullptr;
+}
+
+void MemtableIterator::next() {
+    node = node->nxt[0].load(std::memory_order_acquire);
+    skipInvisible();
+}
+
+void MemtableIterator::seek(uint64_t key) {
+    node = mem->lowerBound(key);
+    skipInvisible();
+}
+
+LevelIterator::LevelIterator(const TableRef *tables, size_t num, uint64_t upper, Open open) :
+    tables(tables),
+    num(num),
+    upper(upper),
+    open(std::move(open)) {}
+
+void LevelIterator::openFrom(uint64_t key) {
+    iter = nullptr;
+    for (; pos < num; ++pos) {
+        const TableMeta &table = *tables[pos];
+        if (table.getMinV() > upper)
+            return; // 后面的文件更大
+        uint64_t lo = std::max(key, table.getMinV());
+        if (lo > table.getMaxV() || !table.mayContain(lo, upper))
+            continue;
+        iter = open(table);
+        iter->seek(lo);
+        if (iter->valid() && iter->key() <= upper)
+            return;
+    }
+    iter = nullptr;
+}
+
+void LevelIterator::next() {
+    iter->next();
+    if (iter->valid() && iter->key() <= upper)
+        return;
+    ++pos;
+    openFrom(0);
+}
+
+void LevelIterator::seek(uint64_t key) {
+    // 第一个 maxV >= key 的文件
+    auto it = std::lower_bound(tables, tables + num, key, [](const TableRef &table, uint64_t key) {
+        return table->getMaxV() < key;
+    });
+    pos     = it - tables;
+    openFrom(key);
+}
+
+MergingIterator::MergingIterator(std::vector<std::unique_ptr<InternalIterator>> children) :
+    children(std::move(children)) {}
+
+bool MergingIterator::after(int a, int b) const {
+    uint64_t ka = children[a]->key(), kb = children[b]->key();
+    return ka != kb ? ka > kb : a > b;
+}
+
+void MergingIterator::next() {
+    auto cmp   = [this](int a, int b) { return after(a, b); };
+    uint64_t k = key();
+    while (!heap.empty() && children[heap.front()]->key() == k) { // 更旧的版本一起跳过
+        std::pop_heap(heap.begin(), heap.end(), cmp);
+        int i = heap.back();
+        heap.pop_back();
+        children[i]->next();
+        if (children[i]->valid()) {
+            heap.push_back(i);
+            std::push_heap(heap.begin(), heap.end(), cmp);
+        }
+    }
+}
+
+void MergingIterator::seek(uint64_t key) {
+    heap.clear();
+    for (int i = 0; i < int(children.size()); ++i) {
+        children[i]->seek(key);
+        if (children[i]->valid())
+            heap.push_back(i);
+    }
+    std::make_heap(heap.begin(), heap.end(), [this](int a, int b) { return after(a, b); });
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#ifndef LSM_KV_MERGER_H
+#define LSM_KV_MERGER_H
+#include "skiplist.h"
+#include "version.h"
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string_view>
+#include <vector>
+
+/**
+ * 按 key 升序遍历一个有序的数据源，memtable、sstable 以及它们归并之后都是这个形状.
+ * value 返回的视图在下一次 next/seek 之前有效。
+ */
+class InternalIterator {
+public:
+    virtual ~InternalIterator() = default;
+
+    virtual bool valid() const       = 0;
+    virtual uint64_t key() const     = 0;
+    virtual std::string_view value() = 0; // sstable 第一次访问时才读出
+    virtual void next()              = 0;
+    virtual void seek(uint64_t key)  = 0; // 定位到第一个 >= key 的位置
+};
+
+/* 遍历跳表中 seq 及之前写入的版本，seq 时还不存在的 key 跳过；遍历时跳表可以同时被写 */
+class MemtableIterator : public InternalIterator {
+private:
+    skiplist *mem;
+    uint64_t seq;
+    slnode *node       = nullptr;
+    const slvalue *val = nullptr; // node 在 seq 时的版本，为空表示已经走完
+
+    void skipInvisible(); // 从 node 开始找第一个在 seq 时可见的节点
+
+public:
+    MemtableIterator(skiplist *mem, uint64_t seq) : mem(mem), seq(seq) {}
+
+    bool valid() const override {
+        return val != nullptr;
+    }
+
+    uint64_t key() const override {
+        return node->key;
+    }
+
+    std::string_view value() override {
+        return std::string_view(val->data, val->len);
+    }
+
+    void next() override;
+    void seek(uint64_t key) override;
+};
+
+/**
+ * 依次遍历一组按 key 排好且互不相交的 sstable：level >= 1 的一层，或者单个 level-0 文件.
+ * 走到哪个文件才打开哪个；和 [seek 的 key, upper] 没有交集、或者区间过滤器说这段没有 key 的文件直接跳过，
+ * 所以短的 scan 只读用得到的那一两个文件。tables 所在的 Version 要比迭代器活得久。
+ */
+class LevelIterator : public InternalIterator {
+public:
+    using Open = std::function<std::unique_ptr<InternalIterator>(const TableMeta &table)>;
+
+private:
+    const TableRef *tables;
+    size_t num;
+    uint64_t upper; // 不读 key 比它大的部分
+    Open open;
+
+    size_t pos = 0;                         // 当前文件的下标
+    std::unique_ptr<InternalIterator> iter; // 当前文件，为空表示已经走完
+
+    void openFrom(uint64_t key); // 从 pos 开始找第一个在 [key, upper] 内有 key 的文件
+
+public:
+    LevelIterator(const TableRef *tables, size_t num, uint64_t upper, Open open);
+
+    bool valid() const override {
+        return iter != nullptr;
+    }
+
+    uint64_t key() const override {
+        return iter->key();
+    }
+
+    std::string_view value() override {
+        return iter->value();
+    }
+
+    void next() override;
+    void seek(uint64_t key) override;
+};
+
+/**
+ * 把若干个数据源归并成一个，同一个 key 只出现一次，value 取最新的数据源中的那个.
+ * children 按从新到旧排列，下标小的更新；用一个堆，每前进一步是 O(log n)。
+ */
+class MergingIterator : public InternalIterator {
+private:
+    std::vector<std::unique_ptr<InternalIterator>> children;
+    std::vector<int> heap; // 有效的子迭代器下标，堆顶是 key 最小的，key 相同时是最新的
+
+    bool after(int a, int b) const; // a 应该排在 b 之后
+
+public:
+    explicit MergingIterator(std::vector<std::unique_ptr<InternalIterator>> children);
+
+    bool valid() const override {
+        return !heap.empty();
+    }
+
+    uint64_t key() const override {
+        return children[heap.front()]->key();
+    }
+
+    std::string_view value() override {
+        return children[heap.front()]->value();
+    }
+
+    void next() override; // 所有停在当前 key 上的数据源一起前进
+    void seek(uint64_t key) override;
+};
+
+#endif // LSM_KV_MERGER_H
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "asyncio.h"
+#include "block.h"
+#include "filter.h"
+#include "wal.h"
+
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/* KVStore 的可调参数 */
+struct KVStoreOptions {
+    /* write-ahead log */
+    WalSyncMode walSyncMode    = WAL_SYNC_INTERVAL;
+    uint32_t walSyncIntervalMs = 100; // 仅 WAL_SYNC_INTERVAL 使用
+
+    /* level-0 文件数达到 slowdown 时写入限速，达到 stop 时写入阻塞直到合并跟上 */
+    uint32_t l0SlowdownTrigger = 8;
+    uint32_t l0StopTrigger     = 12;
+    uint64_t delayedWriteRate  = 16 * 1024 * 1024; // 限速时每秒写入的字节数
+
+    /* 一次合并按 key 区间最多拆成几个并行的子合并 */
+    uint32_t maxSubcompactions = std::thread::hardware_concurrency();
+
+    /* table cache 最多保持打开的 sstable 文件数 */
+    size_t tableCacheCapacity = 512;
+
+    /* block cache：总字节数（0 表示不缓存）、放不下时是否拒绝超额
+     * blockSize 是新 sstable 数据块的目标大小；legacy 格式的 sstable 按 blockSize 对齐读入缓存 */
+    size_t blockCacheCapacity     = 8 * 1024 * 1024;
+    bool blockCacheStrictCapacity = false;
+    uint32_t blockSize            = 4096;
+
+    /* 新 sstable 数据块的压缩：第 i 层用 compressionPerLevel[i]（超出的层用最后一项），
+     * 合并到最底层时用 bottommostCompression */
+    std::vector<blockCodec> compressionPerLevel = {CODEC_NONE, CODEC_LZ};
+    blockCodec bottommostCompression            = CODEC_LZ_HIGH;
+
+    /* 新 sstable 的 bloom 每个 key 占的位数，大小随 key 数变化，探测次数取最优；0 表示不建过滤器 */
+    uint32_t bloomBitsPerKey = 10;
+
+    /* 新 sstable 的过滤器：第 i 层用 filterPolicyPerLevel[i]（超出的层用最后一项）。
+     * xor filter 比同样误判率的 bloom 省约 30% 内存，深层的 key 最多，默认用它 */
+    std::vector<filterPolicy> filterPolicyPerLevel = {FILTER_BLOOM, FILTER_XOR};
+
+    /* 新 sstable 的区间过滤器（按 key 高位分桶的 prefix bloom）每个桶占的位数，scan 用它跳过没有 key 的表；
+     * 0 表示不建 */
+    uint32_t rangeFilterBitsPerKey = 8;
+
+    /* scan 顺序读一个 sstable 时的预读窗口：连续往后读时从 initial 翻倍到 max，一次 pread 读一个窗口；
+     * 预读读到的块不放进 block cache。initial 为 0 表示不预读 */
+    uint32_t scanReadaheadInitial = 16 * 1024;
+    uint32_t scanReadaheadMax     = 256 * 1024;
+
+    /* get、multiGet 和合并读输入用的异步读：AIO_AUTO 能用 io_uring 就用，否则退回线程池。
+     * asyncIoDepth 是一个 io_uring 同时在飞的请求数，asyncIoThreads 是线程池的线程数 */
+    AsyncIoMode asyncIoMode = AIO_AUTO;
+    uint32_t asyncIoDepth   = 64;
+    uint32_t asyncIoThreads = 4;
+
+    /* 把 sstable 整个只读映射进来：getPinned 返回的 value 直接指向映射中没压缩的块，不拷贝也不分配；
+     * 映射的文件不经过 asyncReader，没压缩的块也不放进 block cache */
+    bool mmapReads = false;
+
+    /* 启动时并行读取 sstable 的 bloom 和 index 的线程数 */
+    uint32_t openThreads = std::thread::hardware_concurrency();
+};
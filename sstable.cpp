@@ -3,103 +3,114 @@
 #include "sstablehead.h"
 #include "utils.h"
 
+#include <fcntl.h>
 #include <iostream>
+#include <stdexcept>
+#include <unistd.h>
 const uint32_t MAXSIZE = 2 * 1024 * 1024; // 2MB
 
 /*
  *  在path路径下创建一个新的sstable，时间戳为缓存sstable的时间戳
+ *  写出后 head 只保留块索引，不再保留每个 key 的 index；每个数据块按 codec 单独压缩
+ *  过滤器在这里按全部 key 一次建好
  * */
 void sstable::putFile(const char *path) { // 将内存中的输出到二进制文件中
-    // std::cout << "output path" << path << std::endl;
-    FILE *file = fopen(path, "wb");
-    fseek(file, 0, SEEK_SET);
-    // 4个u64变量
-    fwrite(&time, 8, 1, file);
-    fwrite(&cnt, 8, 1, file);
-    fwrite(&minV, 8, 1, file);
-    fwrite(&maxV, 8, 1, file);
-    for (int i = 0; i < 8 * M; i += 8) { // bloom
-        unsigned char cur = 0x0;
-        for (int j = 0; j < 8; ++j)
-            cur |= (filter.getBit(i + j) << j);
-        fwrite(&cur, 1, 1, file);
-    }
-    int size = index.size();
-    for (int i = 0; i < size; ++i) { // index
-        uint64_t key    = index[i].key;
-        uint32_t offset = index[i].offset;
-        fwrite(&key, 8, 1, file);
-        fwrite(&offset, 4, 1, file);
+    std::string out;
+    out.reserve(bytes + 4096);
+    auto put64 = [&](uint64_t v) { out.append(reinterpret_cast<const char *>(&v), 8); };
+    auto put32 = [&](uint32_t v) { out.append(reinterpret_cast<const char *>(&v), 4); };
+    // magic + 4个u64变量
+    put64(SST_MAGIC);
+    put64(time);
+    put64(cnt);
+    put64(minV);
+    put64(maxV);
+    std::vector<uint64_t> keys;
+    keys.reserve(index.size());
+    for (Index &it : index)
+        keys.push_back(it.key);
+    filter = tableFilter(keys, policy, bitsPerKey);
+    filter.encode(out);
+    scanFilter = rangeFilter(keys, rangeBitsPerKey);
+    scanFilter.encode(out);
+
+    // 数据块，攒够 blockSize 就切一块
+    blockBuilder builder;
+    blocks.clear();
+    auto finishBlock = [&]() {
+        uint64_t lastKey = builder.lastKey();
+        std::string blk  = compressBlock(builder.finish(), codec);
+        blocks.push_back(BlockHandle{lastKey, (uint32_t)out.size(), (uint32_t)blk.size()});
+        out += blk;
+    };
+    for (size_t i = 0; i < data.size(); ++i) {
+        builder.add(index[i].key, data[i]);
+        if (builder.size() >= blockSize)
+            finishBlock();
     }
-    size = data.size();
-    for (int i = 0; i < size; ++i) { // datas
-        fwrite(data[i].data(), 1, data[i].length(), file);
+    if (!builder.empty())
+        finishBlock();
+
+    // 块索引 + footer
+    uint64_t indexOffset = out.size();
+    for (BlockHandle &b : blocks) {
+        put64(b.lastKey);
+        put32(b.offset);
+        put32(b.size);
     }
-    fflush(file); // 清空缓冲区
-    fclose(file);
-}
+    put64(indexOffset);
+    put64(blocks.size());
+    put64(SST_MAGIC);
 
-char buf[2097152];
+    FILE *file = fopen(path, "wb");
+    if (file == nullptr)
+        throw std::runtime_error("open sstable failed");
+    // 之后 MANIFEST 会记下它、对应的 WAL 会被删除，文件和目录项都要先落盘
+    bool ok = fwrite(out.data(), 1, out.size(), file) == out.size();
+    ok      = fflush(file) == 0 && ok;
+    ok      = ::fsync(fileno(file)) == 0 && ok;
+    ok      = fclose(file) == 0 && ok;
+    std::string dir(path);
+    dir = dir.rfind('/') == std::string::npos ? "." : dir.substr(0, dir.rfind('/'));
+    if (!ok || utils::syncDir(dir.data()) != 0)
+        throw std::runtime_error("write sstable failed");
+
+    blockBased = true;
+    bytes      = out.size();
+    index.clear();
+    index.shrink_to_fit();
+}
 
 void sstable::loadFile(const char *path) { // load file from the path
-    filename = path;
-    int len = std::strlen(path), c = 0;
-    std::string suf;
-    for (int i = 0; i < len; ++i) {
-        if (c == 2)
-            suf += path[i];
-        if (path[i] == '-') {
-            c++;
-        }
-        if (path[i] == '.')
-            c = 0;
-    }
-    if (suf.size())
-        nameSuffix = std::stoi(suf);
-    else
-        nameSuffix = 0;
-    FILE *file = fopen(path, "rb+");
-    fseek(file, 0, SEEK_SET); // 移动到开头
-    reset();
-    fread(&time, 8, 1, file);
-    fread(&cnt, 8, 1, file);
-    fread(&minV, 8, 1, file);
-    fread(&maxV, 8, 1, file);
-    for (int i = 0; i < 8 * M; i += 8) { // bloom
-        unsigned char cur = 0x0;
-        fread(&cur, 1, 1, file);
-        for (int j = 0; j < 8; ++j) {
-            if ((cur >> j) & 1)
-                filter.setBit(i + j);
-        }
-    }
-    bytes = 10240 + 32 + 12 * cnt;
-    Index temp;
-    for (int i = 0; i < cnt; ++i) { // index
-        fread(&temp.key, 8, 1, file);
-        fread(&temp.offset, 4, 1, file);
-        index.push_back(temp);
-    }
-    bytes += temp.offset;
-    std::string cur; // data
-    fread(buf, 1, index[0].offset, file);
-    buf[index[0].offset] = '\0';
-    cur                  = buf;
-    data.push_back(cur);
-    for (int i = 1; i < cnt; ++i) {
-        fread(buf, 1, index[i].offset - index[i - 1].offset, file);
-        buf[index[i].offset - index[i - 1].offset] = '\0';
-        cur                                        = buf;
-        data.push_back(cur);
+    loadFileHead(path);
+    loadData();
+}
+
+void sstable::loadData() {
+    std::vector<std::string> vals;
+    std::vector<Index> idx;
+    uint32_t pos = 0;
+    TableHandle table(filename);
+    auto fetch = [&](uint64_t offset, uint32_t len) {
+        std::string block = table.read(offset, len);
+        if (block.size() != len)
+            throw std::runtime_error("read file failed");
+        if (blockBased) // legacy 读的是单个 value
+            block = uncompressBlock(std::move(block));
+        return std::make_shared<const std::string>(std::move(block));
+    };
+    for (sstableIterator it(*this, fetch); it.valid(); it.next()) {
+        pos += it.value().length();
+        idx.emplace_back(it.key(), pos);
+        vals.emplace_back(it.value());
     }
-    fflush(file);
-    fclose(file);
+    index  = std::move(idx);
+    data   = std::move(vals);
+    curpos = pos;
 }
 
-bloom sstable::copyFilter() {
-    bloom *res = new bloom;
-    res->setBitset(filter.getBitset());
-    return *res;
+tableFilter sstable::copyFilter() {
+    return filter;
 }
 
 std::vector<Index> sstable::copyIndexs() {
@@ -108,20 +119,23 @@ std::vector<Index> sstable::copyIndexs() {
 }
 
 sstablehead sstable::getHead() {
-    auto *res = new sstablehead;
-    res->setFilename(filename);
-    res->setNamesuffix(nameSuffix);
-    res->setTime(time);
-    res->setCnt(cnt);
-    res->setMinV(minV);
-    res->setMaxV(maxV);
-    res->setBytes(bytes);
-    res->setFilter(filter);
-    res->setIndex(index);
-    return *res;
+    sstablehead res;
+    res.setFilename(filename);
+    res.setNamesuffix(nameSuffix);
+    res.setTime(time);
+    res.setCnt(cnt);
+    res.setMinV(minV);
+    res.setMaxV(maxV);
+    res.setBytes(bytes);
+    res.setBlockBased(blockBased);
+    res.setFilter(filter);
+    res.setScanFilter(scanFilter);
+    res.setIndex(index);
+    res.setBlocks(blocks);
+    return res;
 }
 
-// 向sstable尾部插一个key-val对，同时修改头和bloom filter
+// 向sstable尾部插一个key-val对，同时修改头；过滤器在 putFile 时再建
 void sstable::insert(uint64_t key, const std::string &val) {
     cnt++;
     curpos += val.length();
@@ -129,30 +143,13 @@ void sstable::insert(uint64_t key, const std::string &val) {
     maxV = std::max(maxV, key);
     bytes += 12 + val.length();
     index.emplace_back(key, curpos);
-    filter.insert(key);
     data.push_back(val);
 }
 
 sstable::sstable(const sstablehead &s):
     sstablehead(s)
 {
-    FILE *file = fopen(filename.data(), "rb+");
-    uint32_t startOffset = 10240 + 32 + 12 * cnt;
-    fseek(file, startOffset, SEEK_SET);
-
-    // 读第一个
-    fread(buf, 1, index[0].offset, file);
-    buf[index[0].offset] = '\0';
-    data.push_back(std::string(buf));
-    // 读后面所有
-    for (int i = 1; i < cnt; ++i) {
-        fread(buf, 1, index[i].offset - index[i - 1].offset, file);
-        buf[index[i].offset - index[i - 1].offset] = '\0';
-        data.push_back(std::string(buf));
-    }
-    // 刷新缓冲区
-    fflush(file);
-    fclose(file);
+    loadData();
 }
 
 bool sstable::checkSize(std::string val, int curLevel, int flag) {
@@ -166,3 +163,94 @@ bool sstable::checkSize(std::string val, int curLevel, int flag) {
     }
     return false;
 }
+
+sstableIterator::sstableIterator(const sstablehead &head, AsyncReader &io, uint32_t bufSize) : head(&head) {
+    if (!valid())
+        return;
+    fd = ::open(head.getFilename().data(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("open file failed");
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL); // 这个文件描述只有合并自己用，让内核加大预读
+    reader = std::make_unique<SequentialReader>(io, fd, bufSize);
+    if (head.isBlockBased())
+        loadBlock();
+}
+
+sstableIterator::sstableIterator(const sstablehead &head, Fetch fetch) :
+    head(&head),
+    fetch(std::move(fetch)) {
+    if (valid() && head.isBlockBased())
+        loadBlock();
+}
+
+sstableIterator::~sstableIterator() {
+    reader = nullptr; // 先等预读完成
+    if (fd >= 0)
+        ::close(fd);
+}
+
+std::shared_ptr<const std::string> sstableIterator::read(uint64_t offset, uint32_t len) {
+    if (fetch)
+        return fetch(offset, len);
+    std::string res = reader->read(offset, len);
+    if (res.size() != len)
+        throw std::runtime_error("read file failed");
+    return std::make_shared<const std::string>(std::move(res));
+}
+
+void sstableIterator::loadBlock() {
+    loaded = false;
+    for (; valid(); ++pos) {
+        const BlockHandle &b                    = head->getBlocks()[pos];
+        std::shared_ptr<const std::string> data = read(b.offset, b.size);
+        if (!fetch) // fetch 返回的已经是解压后的块
+            data = std::make_shared<const std::string>(uncompressBlock(*data));
+        block = blockIterator(data);
+        if (block.valid())
+            return;
+    }
+}
+
+std::string_view sstableIterator::value() {
+    if (head->isBlockBased())
+        return block.value();
+    if (!loaded) {
+        uint32_t start = head->getOffset(pos - 1);
+        val            = *read(head->getDataOffset() + start, head->getOffset(pos) - start);
+        loaded         = true;
+    }
+    return val;
+}
+
+void sstableIterator::next() {
+    loaded = false;
+    if (!head->isBlockBased()) {
+        ++pos;
+        return;
+    }
+    block.next();
+    if (!block.valid()) {
+        ++pos;
+        loadBlock();
+    }
+}
+
+void sstableIterator::seek(uint64_t key) {
+    loaded = false;
+    if (!head->isBlockBased()) {
+        pos = head->lowerBound(key);
+        return;
+    }
+    int p = head->findBlock(key);
+    if (p != pos || !valid()) { // 不在当前块中
+        pos = p;
+        loadBlock();
+    }
+    if (!valid())
+        return;
+    block.seek(key);
+    if (!block.valid()) {
+        ++pos;
+        loadBlock();
+    }
+}
@@ -2,19 +2,33 @@
 
 #ifndef LSM_KV_SSTABLE_H
 #define LSM_KV_SSTABLE_H
+#include "asyncio.h"
 #include "bloom.h"
 #include "skiplist.h"
 #include "sstablehead.h"
 
+#include "block.h"
+#include "merger.h"
+
 #include <cstdint>
-#include <vector>
+#include <cstdio>
+#include <functional>
 #include <limits>
-static uint64_t TIME = 0;                     // 全局时间戳
-const uint64_t INF   = std::numeric_limits<uint64_t>::max();
+#include <memory>
+#include <string>
+#include <vector>
+const uint64_t INF = std::numeric_limits<uint64_t>::max();
 
 class sstable : public sstablehead { // 储存sstable的软数据结构
 private:
     std::vector<std::string> data;
+    uint32_t blockSize       = 4096;         // 写文件时数据块的目标大小
+    blockCodec codec         = CODEC_NONE;   // 写文件时数据块的压缩算法
+    uint32_t bitsPerKey      = 10;           // 写文件时 bloom 每个 key 占的位数，0 表示不要过滤器
+    filterPolicy policy      = FILTER_BLOOM; // 写文件时用的过滤器
+    uint32_t rangeBitsPerKey = 8;            // 写文件时区间过滤器每个桶占的位数，0 表示不要
+
+    void loadData(); // 按 head 读出全部 value
 
 public:
     void reset() { // 这里不reset time, namesuf
@@ -23,8 +37,10 @@ public:
         minV   = INF;
         maxV   = 0;
         bytes  = 10240 + 32;
-        filter.reset();
+        filter     = tableFilter();
+        scanFilter = rangeFilter();
         index.clear();
+        blocks.clear();
         data.clear();
     }
 
@@ -35,43 +51,62 @@ public:
         minV   = INF;
         maxV   = 0;
         bytes  = 10240 + 32;
-        filter.reset();
         index.clear();
         data.clear();
     }
 
-    sstable(skiplist *s) { // 将一个memtable转成sstable， 这里时间戳加1
+    sstable(skiplist *s, uint64_t time) { // 将一个memtable转成时间戳为 time 的sstable
         reset();
         curpos      = 0;
         bytes       = 10240 + 32 + s->getBytes();
-        time        = ++TIME;
-        filename    = "./data/level-0/" + std::to_string(TIME) + ".sst"; // 初始的文件名就是时间戳
+        this->time  = time;
+        filename    = "./data/level-0/" + std::to_string(time) + ".sst"; // 初始的文件名就是时间戳
         cnt         = 0;
         minV        = INF;
         maxV        = 0;
         slnode *cur = s->getFirst();
         while (cur->type != TAIL) { // curpos 为这个串的终止地址
+            std::string_view val = cur->value();
             cnt++;
-            curpos += cur->val.length();
+            curpos += val.size();
             minV = std::min(minV, cur->key);
             maxV = std::max(maxV, cur->key);
-            filter.insert(cur->key);
             index.emplace_back(cur->key, curpos);
-            data.push_back(cur->val);
+            data.emplace_back(val);
             cur = cur->nxt[0];
         }
     }
 
     sstable(const sstablehead& s);
 
+    void setBlockSize(uint32_t blockSize) {
+        this->blockSize = blockSize;
+    }
+
+    void setCodec(blockCodec codec) {
+        this->codec = codec;
+    }
+
+    void setBitsPerKey(uint32_t bitsPerKey) {
+        this->bitsPerKey = bitsPerKey;
+    }
+
+    void setFilterPolicy(filterPolicy policy) {
+        this->policy = policy;
+    }
+
+    void setRangeBitsPerKey(uint32_t rangeBitsPerKey) {
+        this->rangeBitsPerKey = rangeBitsPerKey;
+    }
+
     bool checkSize(std::string val, int curLevel,
                    int flag);        // 检查大小，如果不够加val, 创新sstable
-    void putFile(const char *path);  //  将sstable输出到路径
+    void putFile(const char *path);  //  将sstable按 block-based 格式输出到路径
     void loadFile(const char *path); // 从路径载入一个sstable
 
     void insert(uint64_t key, const std::string &val);
 
-    bloom copyFilter();
+    tableFilter copyFilter();
     std::vector<Index> copyIndexs();
 
     std::string getData(int p) {
@@ -81,4 +116,54 @@ public:
     sstablehead getHead(); // 取出头部
 };
 
+/**
+ * 按 key 顺序读取一个 sstable，两种格式都支持.
+ * 合并时传入 io 顺序读文件：读当前 bufSize 大小的一段时在后台读下一段，只占用两段的缓冲；
+ * 也可以传入 fetch 从别处（比如 block cache）取数据，fetch 返回的数据块必须已经解压。
+ * head 必须比迭代器活得久。
+ */
+class sstableIterator : public InternalIterator {
+public:
+    using Fetch = std::function<std::shared_ptr<const std::string>(uint64_t offset, uint32_t len)>;
+
+private:
+    const sstablehead *head;
+    Fetch fetch;
+    int fd = -1;
+    std::unique_ptr<SequentialReader> reader;
+
+    int pos = 0;         // legacy 为 entry 下标，block-based 为数据块下标
+    blockIterator block; // block-based 当前数据块
+    std::string val;     // legacy 读出的 value
+    bool loaded = false; // val 是否已经读出
+
+    std::shared_ptr<const std::string> read(uint64_t offset, uint32_t len);
+    void loadBlock(); // block-based：载入 pos 处及之后第一个非空的数据块
+
+public:
+    sstableIterator(const sstablehead &head, AsyncReader &io, uint32_t bufSize = 64 * 1024);
+    sstableIterator(const sstablehead &head, Fetch fetch);
+    ~sstableIterator();
+
+    sstableIterator(const sstableIterator &)            = delete;
+    sstableIterator &operator=(const sstableIterator &) = delete;
+
+    bool valid() const override {
+        return head->isBlockBased() ? size_t(pos) < head->getBlocks().size() : uint64_t(pos) < head->getCnt();
+    }
+
+    uint64_t key() const override {
+        return head->isBlockBased() ? block.key() : head->getKey(pos);
+    }
+
+    std::string_view value() override; // block-based 直接指向当前数据块，legacy 第一次访问时才读出
+
+    uint64_t time() const {
+        return head->getTime();
+    }
+
+    void next() override;
+    void seek(uint64_t key) override; // 定位到第一个 >= key 的位置
+};
+
 #endif // LSM_KV_SSTABLE_H
@@ -1,11 +1,15 @@
 #include "sstablehead.h"
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <stdexcept>
 
 void sstablehead::loadFileHead(const char *path) { // 只读取文件头
-    FILE *file = fopen(path, "rb+");               // 注意格式为二进制
-    filename   = path;
+    FILE *file = fopen(path, "rb");                // 注意格式为二进制
+    if (file == nullptr)
+        throw std::runtime_error("open sstable failed");
+    filename = path;
     int len = std::strlen(path), c = 0;
     std::string suf;
     for (int i = 0; i < len; ++i) {
@@ -21,39 +25,100 @@ void sstablehead::loadFileHead(const char *path) { // 只读取文件头
         nameSuffix = std::stoi(suf);
     else
         nameSuffix = 0;
-    fseek(file, 0, SEEK_SET);
-    reset();
 
-    fread(&time, 8, 1, file);
+    uint64_t magic = 0;
+    fread(&magic, 8, 1, file);
+    blockBased = magic == SST_MAGIC;
+    if (!blockBased)
+        time = magic; // legacy 文件开头就是时间戳
+    else
+        fread(&time, 8, 1, file);
     fread(&cnt, 8, 1, file);
     fread(&minV, 8, 1, file);
     fread(&maxV, 8, 1, file);
-    for (int i = 0; i < M * 8; i += 8) { // bloom
-        unsigned char cur = 0x0;
-        fread(&cur, 1, 1, file);
-        for (int j = 0; j < 8; ++j) {
-            if ((cur >> j) & 1)
-                filter.setBit(i + j);
-        }
+    loadFilterAndIndex(file);
+    fclose(file);
+}
+
+void sstablehead::loadFilterAndIndex() {
+    FILE *file = fopen(filename.data(), "rb");
+    if (file == nullptr)
+        throw std::runtime_error("open sstable failed");
+    uint64_t magic = 0;
+    fread(&magic, 8, 1, file);
+    blockBased = magic == SST_MAGIC;
+    fseek(file, blockBased ? 40 : 32, SEEK_SET);
+    loadFilterAndIndex(file);
+    fclose(file);
+}
+
+/* 读过滤器和 index（legacy）或块索引（block-based），各一次 fread */
+void sstablehead::loadFilterAndIndex(FILE *file) {
+    reset();
+    if (blockBased) {
+        uint32_t filterHead[2]; // policy | bytes
+        if (fread(filterHead, 4, 2, file) != 2)
+            throw std::runtime_error("read sstable head failed");
+        std::vector<char> buf(filterHead[1]);
+        if (fread(buf.data(), 1, buf.size(), file) != buf.size())
+            throw std::runtime_error("read sstable head failed");
+        if (!filter.decode(filterHead[0], buf.data(), buf.size()))
+            throw std::runtime_error("bad sstable filter");
+        uint32_t rangeBytes;
+        if (fread(&rangeBytes, 4, 1, file) != 1)
+            throw std::runtime_error("read sstable head failed");
+        buf.resize(rangeBytes);
+        if (fread(buf.data(), 1, rangeBytes, file) != rangeBytes || !scanFilter.decode(buf.data(), rangeBytes))
+            throw std::runtime_error("bad sstable filter");
+        loadBlocks(file);
+        return;
     }
-    Index temp;
-    bytes = 10240 + 32 + 12 * cnt;
-    for (int i = 0; i < cnt; ++i) { // index
-        fread(&temp.key, 8, 1, file);
-        fread(&temp.offset, 4, 1, file);
+    // legacy：固定 M 字节、4 次探测的 bloom，之后是每个 key 一项的 index
+    std::vector<unsigned char> buf(std::max<size_t>(M, 12 * cnt));
+    if (fread(buf.data(), 1, M, file) != M)
+        throw std::runtime_error("read sstable head failed");
+    bloom bf;
+    bf.load(reinterpret_cast<const char *>(buf.data()), M, false, 4);
+    filter = tableFilter(bf);
+    if (fread(buf.data(), 1, 12 * cnt, file) != 12 * cnt)
+        throw std::runtime_error("read sstable head failed");
+    Index temp(0, 0);
+    index.reserve(cnt);
+    for (uint64_t i = 0; i < cnt; ++i) { // index
+        memcpy(&temp.key, &buf[12 * i], 8);
+        memcpy(&temp.offset, &buf[12 * i + 8], 4);
         index.push_back(temp);
     }
-    bytes += temp.offset;
-    fflush(file);
-    fclose(file);
+    bytes = 10240 + 32 + 12 * cnt + temp.offset;
+}
+
+/* block-based：从 footer 找到块索引并读入 */
+void sstablehead::loadBlocks(FILE *file) {
+    uint64_t footer[3];
+    if (fseek(file, -(long)FOOTER_SIZE, SEEK_END) != 0 || fread(footer, 8, 3, file) != 3 || footer[2] != SST_MAGIC)
+        throw std::runtime_error("bad sstable footer");
+    uint64_t indexOffset = footer[0], n = footer[1];
+    std::vector<char> buf(16 * n);
+    fseek(file, indexOffset, SEEK_SET);
+    if (fread(buf.data(), 1, buf.size(), file) != buf.size())
+        throw std::runtime_error("read sstable index failed");
+    blocks.resize(n);
+    for (uint64_t i = 0; i < n; ++i) {
+        memcpy(&blocks[i].lastKey, &buf[16 * i], 8);
+        memcpy(&blocks[i].offset, &buf[16 * i + 8], 4);
+        memcpy(&blocks[i].size, &buf[16 * i + 12], 4);
+    }
+    bytes = indexOffset + buf.size() + FOOTER_SIZE;
 }
 
 void sstablehead::reset() {
-    filter.reset();
+    filter     = tableFilter();
+    scanFilter = rangeFilter();
     index.clear();
+    blocks.clear();
 }
 
-int sstablehead::search(uint64_t key) {
+int sstablehead::search(uint64_t key) const {
     int res = filter.search(key);
     if (!res)
         return -1; // bloom 说没有 确实没有
@@ -65,7 +130,7 @@ int sstablehead::search(uint64_t key) {
     return -1;
 }
 
-int sstablehead::searchOffset(uint64_t key, uint32_t &len) {
+int sstablehead::searchOffset(uint64_t key, uint32_t &len) const {
     int res = filter.search(key);
     if (!res)
         return -1; // bloom 说没有 确实没有
@@ -84,7 +149,62 @@ int sstablehead::searchOffset(uint64_t key, uint32_t &len) {
     return -1;
 }
 
-int sstablehead::lowerBound(uint64_t key) {
+int sstablehead::lowerBound(uint64_t key) const {
     auto it = std::lower_bound(index.begin(), index.end(), Index(key, 0));
     return it - index.begin(); // found
 }
+
+int sstablehead::findBlock(uint64_t key) const {
+    auto it = std::lower_bound(blocks.begin(), blocks.end(), key, [](const BlockHandle &b, uint64_t key) {
+        return b.lastKey < key;
+    });
+    return it - blocks.begin();
+}
+
+locateResult sstablehead::locate(uint64_t key, uint64_t &offset, uint32_t &len) const {
+    if (key < minV || key > maxV)
+        return NOT_FOUND;
+    stats->checks.fetch_add(1, std::memory_order_relaxed);
+    if (!filter.search(key))
+        return NOT_FOUND; // bloom 说没有 确实没有
+    stats->positives.fetch_add(1, std::memory_order_relaxed);
+    if (!isBlockBased()) {
+        int res = searchOffset(key, len);
+        if (res == -1) {
+            stats->falsePositives.fetch_add(1, std::memory_order_relaxed);
+            return NOT_FOUND;
+        }
+        offset = getDataOffset() + res;
+        return FOUND_VALUE;
+    }
+    int b = findBlock(key);
+    if (size_t(b) == blocks.size()) {
+        stats->falsePositives.fetch_add(1, std::memory_order_relaxed);
+        return NOT_FOUND;
+    }
+    offset = blocks[b].offset;
+    len    = blocks[b].size;
+    return IN_BLOCK; // 是否误判要读出数据块才知道，由调用者记录
+}
+
+/* 区间很短时逐个查点过滤器，否则查区间过滤器 */
+bool sstablehead::mayContain(uint64_t lo, uint64_t hi) const {
+    lo = std::max(lo, minV);
+    hi = std::min(hi, maxV);
+    if (lo > hi)
+        return false;
+    stats->rangeChecks.fetch_add(1, std::memory_order_relaxed);
+    bool res = false;
+    if (hi - lo < rangeFilter::MAX_BUCKETS) {
+        for (uint64_t key = lo; !res; ++key) {
+            res = filter.search(key);
+            if (key == hi)
+                break;
+        }
+    } else {
+        res = scanFilter.mayContain(lo, hi);
+    }
+    if (!res)
+        stats->rangeSkips.fetch_add(1, std::memory_order_relaxed);
+    return res;
+}
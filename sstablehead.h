@@ -2,11 +2,15 @@
 
 #ifndef LSM_KV_SSTABLEHEAD_H
 #define LSM_KV_SSTABLEHEAD_H
-#include "bloom.h"
+#include "filter.h"
 
+#include <atomic>
 #include <cstdint>
-#include <vector>
+#include <cstdio>
 #include <limits>
+#include <memory>
+#include <string>
+#include <vector>
 
 struct Index {
     uint64_t key;
@@ -24,6 +28,40 @@ struct Index {
     }
 };
 
+/* block-based sstable 的一个数据块：块内最大的 key 和它在文件中的位置 */
+struct BlockHandle {
+    uint64_t lastKey;
+    uint32_t offset, size;
+};
+
+/**
+ * sstable 文件格式.
+ * legacy:      time | cnt | minV | maxV | bloom（M 字节，4 次探测）| (key, offset) * cnt | values
+ * block-based: magic | time | cnt | minV | maxV | tableFilter | rangeFilter | 数据块 * n | 块索引 | footer
+ *   tableFilter = policy(u32) | bytes(u32) | payload，bloom 或 xor filter
+ *   rangeFilter = bytes(u32) | payload，scan 用它跳过区间内没有 key 的表
+ *   数据块末尾 1 字节 codec，块内容可能被压缩
+ *   块索引 = (lastKey, offset, size) * n，footer = indexOffset | n | magic
+ * legacy 文件开头是时间戳，不会和 magic 相同。
+ */
+const uint64_t SST_MAGIC   = 0x3756545353564B4Cull; // "LKVSSTV7"
+const uint32_t FOOTER_SIZE = 24;
+
+/* bloom 的使用统计，同一个 sstable 的各个 head 副本共享一份 */
+struct FilterStats {
+    std::atomic<uint64_t> checks{0};         // 查询 bloom 的次数
+    std::atomic<uint64_t> positives{0};      // bloom 说可能存在的次数
+    std::atomic<uint64_t> falsePositives{0}; // 其中实际不存在的次数
+    std::atomic<uint64_t> rangeChecks{0};    // scan 询问区间内是否有 key 的次数
+    std::atomic<uint64_t> rangeSkips{0};     // 其中确定没有、不用读表的次数
+};
+
+enum locateResult {
+    NOT_FOUND,   // 一定不在这个 sstable 中
+    FOUND_VALUE, // legacy 格式：offset/len 就是 value 的位置
+    IN_BLOCK     // block-based 格式：如果存在，一定在 offset/len 指向的数据块中
+};
+
 class sstablehead {
 protected:
     std::string filename; // filename表示该sstable的名字，含路径前缀和后缀
@@ -31,8 +69,12 @@ protected:
     uint32_t bytes;          // 理论上的sstable转换成文件的大小
     uint32_t curpos;         // 当前offset的位置
     uint32_t nameSuffix = 0; // 区分同一时间戳，不同文件的姓名后缀
-    bloom filter;
-    std::vector<Index> index;
+    bool blockBased     = true; // 文件格式，false 为 legacy
+    tableFilter filter;
+    rangeFilter scanFilter;
+    std::shared_ptr<FilterStats> stats = std::make_shared<FilterStats>();
+    std::vector<Index> index;        // 仅 legacy 格式，每个 key 一项
+    std::vector<BlockHandle> blocks; // 仅 block-based 格式，每个数据块一项
 
 public:
     bool operator<(const sstablehead &other) const {
@@ -51,6 +93,9 @@ public:
     }
 
     void loadFileHead(const char *path);
+    void loadFilterAndIndex(); // 元数据已知（来自 MANIFEST）时只读 bloom 和 index
+    void loadFilterAndIndex(FILE *file); // 文件位置在过滤器的开头，blockBased 和 cnt 必须已经设置
+    void loadBlocks(FILE *file);
     void reset();
 
     void setFilename(std::string filename) {
@@ -81,18 +126,62 @@ public:
         this->bytes = bytes;
     }
 
-    void setFilter(bloom filter) {
-        this->filter.setBitset(filter.getBitset());
+    void setFilter(const tableFilter &filter) {
+        this->filter = filter;
+    }
+
+    void setScanFilter(const rangeFilter &scanFilter) {
+        this->scanFilter = scanFilter;
     }
 
     void setIndex(std::vector<Index> index) {
         this->index = index;
     } // 使用深复制
 
-    std::string getFilename() {
+    void setBlocks(std::vector<BlockHandle> blocks) {
+        this->blocks = blocks;
+    }
+
+    void setBlockBased(bool blockBased) {
+        this->blockBased = blockBased;
+    }
+
+    std::string getFilename() const {
         return filename;
     }
 
+    bool isBlockBased() const {
+        return blockBased;
+    }
+
+    uint32_t getDataOffset() const { // legacy 格式数据区的起点
+        return 32 + 10240 + 12 * cnt;
+    }
+
+    filterPolicy getFilterPolicy() const {
+        return filter.getPolicy();
+    }
+
+    size_t getFilterBytes() const {
+        return filter.size();
+    }
+
+    size_t getRangeFilterBytes() const {
+        return scanFilter.size();
+    }
+
+    uint32_t getNumProbes() const {
+        return filter.getNumProbes();
+    }
+
+    const std::shared_ptr<FilterStats> &getStats() const {
+        return stats;
+    }
+
+    const std::vector<BlockHandle> &getBlocks() const {
+        return blocks;
+    }
+
     uint64_t getTime() const {
         return time;
     }
@@ -109,7 +198,7 @@ public:
         return maxV;
     }
 
-    uint64_t getKey(int p) {
+    uint64_t getKey(int p) const {
         return index[p].key;
     }
 
@@ -121,7 +210,7 @@ public:
         return nameSuffix;
     }
 
-    uint32_t getOffset(int p) {
+    uint32_t getOffset(int p) const {
         return (p < 0) ? 0 : index[p].offset;
     }
 
@@ -129,10 +218,13 @@ public:
         return index[p];
     }
 
-    int searchOffset(uint64_t key, uint32_t &len);
+    int searchOffset(uint64_t key, uint32_t &len) const;
+    locateResult locate(uint64_t key, uint64_t &offset, uint32_t &len) const;
+    bool mayContain(uint64_t lo, uint64_t hi) const; // [lo, hi] 中可能有 key，scan 用
 
-    int search(uint64_t key);
-    int lowerBound(uint64_t key); /*返回大于等于的第一个的下标 没有返回len + 1*/
+    int search(uint64_t key) const;
+    int lowerBound(uint64_t key) const; /*返回大于等于的第一个的下标 没有返回len + 1*/
+    int findBlock(uint64_t key) const;  // 第一个 lastKey >= key 的数据块，没有返回块数
     void showIndexs();
 };
 
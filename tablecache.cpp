@@ -0,0 +1,122 @@
+#include "tablecache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static std::atomic<uint64_t> nextTableId(1);
+
+TableHandle::TableHandle(const std::string &filename, bool mmapped) : id(nextTableId++) {
+    fd = ::open(filename.data(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("open file failed");
+    struct stat st;
+    if (!mmapped || ::fstat(fd, &st) != 0 || st.st_size == 0)
+        return;
+    void *addr = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED)
+        return;
+    map     = static_cast<const char *>(addr);
+    mapSize = st.st_size;
+}
+
+TableHandle::~TableHandle() {
+    if (map != nullptr)
+        ::munmap(const_cast<char *>(map), mapSize);
+    ::close(fd);
+}
+
+std::string_view TableHandle::mapped(uint64_t offset, uint32_t len) const {
+    if (offset >= mapSize)
+        return {};
+    return std::string_view(map + offset, std::min<uint64_t>(len, mapSize - offset));
+}
+
+std::string TableHandle::read(uint64_t offset, uint32_t len) const {
+    if (map != nullptr)
+        return std::string(mapped(offset, len));
+    std::string res(len, '\0');
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = ::pread(fd, &res[done], len - done, offset + done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            throw std::runtime_error("read file failed");
+        if (n == 0)
+            break; // 文件尾
+        done += n;
+    }
+    res.resize(done);
+    return res;
+}
+
+void TableHandle::prefetch(uint64_t offset, uint32_t len) const {
+    ::posix_fadvise(fd, offset, len, POSIX_FADV_WILLNEED); // 只是建议，失败了也不影响正确性
+}
+
+ReadaheadReader::ReadaheadReader(std::shared_ptr<TableHandle> table, uint32_t initial, uint32_t max) :
+    table(std::move(table)),
+    initial(initial),
+    max(std::max(initial, max)) {}
+
+std::string ReadaheadReader::read(uint64_t offset, uint32_t len) {
+    bool forward = offset >= lastEnd && offset - lastEnd <= std::max(window, initial);
+    sequential   = forward ? sequential + 1 : 0;
+    lastEnd      = offset + len;
+    if (initial == 0 || sequential < 2) {
+        window = 0;
+        return table->read(offset, len);
+    }
+    if (offset < bufStart || offset + len > bufStart + buf.size()) { // 读完了当前窗口
+        window   = window ? std::min(window * 2, max) : initial;
+        bufStart = offset;
+        buf      = table->read(offset, std::max(window, len));
+        if (buf.size() == std::max(window, len))
+            table->prefetch(offset + buf.size(), window); // 没到文件尾，下一个窗口交给内核先读
+    }
+    return buf.substr(offset - bufStart, len);
+}
+
+TableCache::TableCache(size_t capacity, bool mmapReads) :
+    capacity(std::max<size_t>(capacity, 1)),
+    mmapReads(mmapReads) {}
+
+std::shared_ptr<TableHandle> TableCache::get(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = table.find(filename);
+    if (it != table.end()) {
+        lru.splice(lru.begin(), lru, it->second); // 移到队首
+        return it->second->second;
+    }
+
+    // 在锁内打开，避免 evict 之后又把已删除文件的句柄放回缓存
+    auto handle = std::make_shared<TableHandle>(filename, mmapReads);
+    lru.emplace_front(filename, handle);
+    table[filename] = lru.begin();
+    if (lru.size() > capacity) {
+        table.erase(lru.back().first);
+        lru.pop_back();
+    }
+    return handle;
+}
+
+void TableCache::evict(const std::string &filename) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = table.find(filename);
+    if (it == table.end())
+        return;
+    lru.erase(it->second);
+    table.erase(it);
+}
+
+void TableCache::clear() {
+    std::lock_guard<std::mutex> lock(mtx);
+    table.clear();
+    lru.clear();
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#ifndef LSM_KV_TABLECACHE_H
+#define LSM_KV_TABLECACHE_H
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+/**
+ * 一个打开的 sstable 文件，最后一个引用释放时才关闭.
+ * mmapped 时把整个文件只读映射进来，mapped 返回的视图和句柄活得一样久：文件被合并掉删除之后映射仍然有效，
+ * 最后一个引用（包括 getPinned 返回的 PinnedValue）释放时才解除。映射失败（比如空文件）就退回 pread。
+ */
+class TableHandle {
+public:
+    explicit TableHandle(const std::string &filename, bool mmapped = false);
+
+    ~TableHandle();
+
+    TableHandle(const TableHandle &)            = delete;
+    TableHandle &operator=(const TableHandle &) = delete;
+
+    std::string read(uint64_t offset, uint32_t len) const;        // pread（映射了就从映射中拷贝），可以并发调用；读到文件尾会变短
+    std::string_view mapped(uint64_t offset, uint32_t len) const; // 映射中的 [offset, offset + len)，不拷贝；读到文件尾会变短
+    void prefetch(uint64_t offset, uint32_t len) const;           // 让内核在后台把这段读进 page cache，不等待
+
+    uint64_t getId() const {
+        return id;
+    }
+
+    int getFd() const { // 交给 AsyncReader 异步读，句柄要活到读完
+        return fd;
+    }
+
+    bool isMapped() const {
+        return map != nullptr;
+    }
+
+private:
+    int fd;
+    uint64_t id;               // 每次打开都不同，作为 block cache 的 key
+    const char *map = nullptr; // 整个文件的只读映射，没有映射时为空
+    uint64_t mapSize = 0;
+};
+
+/**
+ * 顺序扫描一个 sstable 时的预读缓冲，scan 中每个 sstable 迭代器一个，不能并发使用.
+ * 前两次照常按请求的大小读；之后如果一直往后读（中间跳过的不超过一个窗口，比如命中 block cache 的块），
+ * 就一次 pread 读进一个窗口，窗口从 initial 开始每次翻倍直到 max，同时 posix_fadvise(WILLNEED)
+ * 让内核在后台读下一个窗口。往回或者跳远了就回到按请求读。initial 为 0 表示不预读。
+ */
+class ReadaheadReader {
+public:
+    ReadaheadReader(std::shared_ptr<TableHandle> table, uint32_t initial, uint32_t max);
+
+    std::string read(uint64_t offset, uint32_t len); // 同 TableHandle::read
+
+    bool active() const { // 正在预读，说明这是一次长的 scan
+        return window != 0;
+    }
+
+private:
+    std::shared_ptr<TableHandle> table;
+    uint32_t initial, max;
+    uint32_t window  = 0; // 当前的预读窗口，0 表示没有在预读
+    int sequential   = 0; // 连续往后读的次数
+    uint64_t lastEnd = 0; // 上一次读的结尾
+    std::string buf;      // [bufStart, bufStart + buf.size()) 的内容
+    uint64_t bufStart = 0;
+};
+
+/**
+ * 打开的 sstable 文件的 LRU 缓存，以文件名为 key.
+ *
+ * 句柄是 shared_ptr：读者拿到之后，即使它被换出或者文件被合并删除也能继续用，
+ * 最后一个使用者放手时才关闭 fd。缓存里最多保持 capacity 个打开的文件。
+ */
+class TableCache {
+public:
+    explicit TableCache(size_t capacity, bool mmapReads = false); // mmapReads 时打开的文件都映射进来
+
+    std::shared_ptr<TableHandle> get(const std::string &filename);
+    void evict(const std::string &filename); // 文件被删除时调用
+    void clear();
+
+private:
+    size_t capacity;
+    bool mmapReads;
+
+    std::mutex mtx;
+    std::list<std::pair<std::string, std::shared_ptr<TableHandle>>> lru; // 队首是最近使用的
+    std::unordered_map<std::string, decltype(lru)::iterator> table;
+};
+
+#endif // LSM_KV_TABLECACHE_H
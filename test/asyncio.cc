@@ -0,0 +1,89 @@
+#include "asyncio.h"
+#include <cstdio>
+#include <fcntl.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <system_error>
+#include <unistd.h>
+#include <vector>
+
+/* 异步读引擎的测试：io_uring（内核支持时）和线程池读出的内容都要和文件一致 */
+
+const char *path      = "./asyncio_test.dat";
+const size_t fileSize = 4 * 1024 * 1024;
+
+/* 随机的分散读，有的越过文件尾 */
+static bool random_reads(AsyncReader &io, int fd, const std::string &content) {
+    std::mt19937_64 rng(2024);
+    bool ok = true;
+    for (int round = 0; round < 100; ++round) {
+        size_t n = 1 + rng() % 64;
+        std::vector<std::string> bufs(2 * n);
+        std::vector<iovec> iov(2 * n);
+        std::vector<ReadRequest> reqs(n);
+        for (size_t i = 0; i < n; ++i) {
+            bufs[2 * i].resize(1 + rng() % 8192);
+            bufs[2 * i + 1].resize(1 + rng() % 8192);
+            iov[2 * i]     = {bufs[2 * i].data(), bufs[2 * i].size()};
+            iov[2 * i + 1] = {bufs[2 * i + 1].data(), bufs[2 * i + 1].size()};
+            reqs[i]        = {fd, rng() % (fileSize + 4096), &iov[2 * i], 2};
+        }
+        if (round % 2)
+            io.read(reqs.data(), n);
+        else
+            io.submit(reqs.data(), n)->wait();
+        for (size_t i = 0; i < n; ++i) {
+            uint64_t offset = reqs[i].offset;
+            size_t want     = std::min(bufs[2 * i].size() + bufs[2 * i + 1].size(), fileSize - std::min(offset, fileSize));
+            std::string got = (bufs[2 * i] + bufs[2 * i + 1]).substr(0, want);
+            ok &= reqs[i].res == int64_t(want) && got == content.substr(std::min(offset, fileSize), want);
+        }
+    }
+    return ok;
+}
+
+/* 顺序读整个文件，中间夹着往回跳 */
+static bool sequential_reads(AsyncReader &io, int fd, const std::string &content) {
+    SequentialReader reader(io, fd, 64 * 1024);
+    bool ok = true;
+    for (uint64_t offset = 0; offset < fileSize; offset += 3000)
+        ok &= reader.read(offset, 3000) == content.substr(offset, 3000);
+    ok &= reader.read(100, 200000) == content.substr(100, 200000);
+    ok &= reader.read(fileSize - 10, 100) == content.substr(fileSize - 10);
+    return ok;
+}
+
+static bool run(const std::string &name, AsyncIoMode mode, unsigned threads, int fd, const std::string &content) {
+    std::unique_ptr<AsyncReader> io;
+    try {
+        io = AsyncReader::create(mode, 16, threads);
+    } catch (const std::system_error &e) {
+        std::cout << "[" << name << "] 跳过: " << e.what() << std::endl;
+        return true;
+    }
+    bool ok = random_reads(*io, fd, content) && sequential_reads(*io, fd, content);
+    std::cout << "[" << name << "] " << io->name() << (ok ? " [PASS]" : " [FAIL]") << std::endl;
+    return ok;
+}
+
+int main() {
+    std::mt19937_64 rng(1);
+    std::string content(fileSize, '\0');
+    for (char &c : content)
+        c = 'a' + rng() % 26;
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || write(fd, content.data(), fileSize) != fileSize) {
+        std::cout << "write test file failed" << std::endl;
+        return 1;
+    }
+
+    bool ok = run("io_uring", AIO_IO_URING, 0, fd, content);
+    ok &= run("thread pool", AIO_THREAD_POOL, 4, fd, content);
+    ok &= run("inline", AIO_THREAD_POOL, 0, fd, content);
+    ok &= run("auto", AIO_AUTO, 4, fd, content);
+
+    close(fd);
+    remove(path);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,77 @@
+#include "test.h"
+
+#include <random>
+#include <vector>
+
+/* level-1 超过上限时按 compactPointer 轮流取 sstable：到了末尾要从头再来，不能一直取最后几个 */
+class CompactionTest : public Test {
+private:
+    const uint64_t KEYS = 12000; // 每个 value 1000 字节，全部 key 大约 6 个 sstable，level-1 放不下
+
+    void round_robin_test(int rounds) {
+        std::mt19937_64 rng(2024);
+        std::vector<int> latest(KEYS, -1);
+        std::vector<uint64_t> pointers;
+
+        for (int r = 0; r < rounds; ++r) {
+            for (uint64_t i = 0; i < 3 * KEYS / 2; ++i) {
+                uint64_t key = rng() % KEYS;
+                latest[key]  = r;
+                store.put(key, std::string(1000, 'a' + r % 26));
+            }
+            store.compaction();
+            pointers.push_back(store.getCompactPointer(1));
+        }
+
+        // 指针走过后半段之后还要回到前半段，而且不止一次
+        int wraps = 0;
+        for (size_t i = 1; i < pointers.size(); ++i) {
+            if (pointers[i - 1] >= KEYS / 2 && pointers[i] < KEYS / 2)
+                ++wraps;
+        }
+        if (verbose) {
+            std::cout << "  compactPointer:";
+            for (uint64_t p : pointers)
+                std::cout << " " << p;
+            std::cout << std::endl;
+        }
+        EXPECT(true, wraps >= 2);
+
+        for (uint64_t key = 0; key < KEYS; ++key)
+            EXPECT(latest[key] < 0 ? not_found : std::string(1000, 'a' + latest[key] % 26), store.get(key));
+
+        phase();
+    }
+
+public:
+    CompactionTest(const std::string &dir, bool v = true) : Test(dir, v) {}
+
+    void start_test(void *args = NULL) override {
+        std::cout << "KVStore Compaction Test" << std::endl;
+
+        store.reset();
+
+        std::cout << "[Round Robin Test]" << std::endl;
+        round_robin_test(24);
+
+        store.reset();
+
+        report();
+    }
+};
+
+int main(int argc, char *argv[]) {
+    bool verbose = (argc == 2 && std::string(argv[1]) == "-v");
+
+    std::cout << "Usage: " << argv[0] << " [-v]" << std::endl;
+    std::cout << "  -v: print extra info for failed tests [currently ";
+    std::cout << (verbose ? "ON" : "OFF") << "]" << std::endl;
+    std::cout << std::endl;
+    std::cout.flush();
+
+    CompactionTest test("./data", verbose);
+
+    test.start_test();
+
+    return 0;
+}
@@ -0,0 +1,81 @@
+#include "kvstore.h"
+#include <chrono>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <random>
+
+/* 对比不同的数据块压缩算法：落盘大小（I/O）与读写耗时（CPU） */
+
+const int num_keys = 100000;
+
+static std::vector<std::string> make_values() {
+    // 从一个小词表里随机拼出的英文文本，压缩比与真实文本相近
+    const char *words[] = {"the ", "of ", "and ", "storage ", "engine ", "writes ", "a ", "sorted ", "table ",
+                           "to ", "disk ", "when ", "memtable ", "is ", "full ", "compaction ", "merges ", "levels ",
+                           "bloom ", "filter ", "skips ", "files ", "that ", "cannot ", "contain ", "key ", "value "};
+    std::mt19937 rng(2024);
+    std::vector<std::string> values(num_keys);
+    for (auto &v : values) {
+        size_t len = 100 + rng() % 400;
+        while (v.size() < len)
+            v += words[rng() % (sizeof(words) / sizeof(words[0]))];
+    }
+    return values;
+}
+
+static uint64_t disk_bytes(const std::string &dir) {
+    uint64_t res = 0;
+    for (auto &entry : std::filesystem::recursive_directory_iterator(dir)) {
+        if (entry.is_regular_file() && entry.path().extension() == ".sst")
+            res += entry.file_size();
+    }
+    return res;
+}
+
+static double measure_us(const std::function<void()> &func) {
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+static void run(const std::string &name, blockCodec codec, const std::vector<std::string> &values) {
+    KVStoreOptions options;
+    options.compressionPerLevel   = {codec};
+    options.bottommostCompression = codec;
+    options.blockCacheCapacity    = 0; // 每次读都要从文件取块并解压
+
+    KVStore store("./data", options);
+    store.reset();
+    double put = measure_us([&]() {
+        for (int i = 0; i < num_keys; ++i)
+            store.put(i, values[i]);
+        store.compaction();
+    });
+
+    std::mt19937 rng(7);
+    int wrong  = 0;
+    double get = measure_us([&]() {
+        for (int i = 0; i < num_keys; ++i) {
+            int key = rng() % num_keys;
+            wrong += store.get(key) != values[key];
+        }
+    });
+
+    uint64_t raw = 0;
+    for (auto &v : values)
+        raw += v.size();
+    uint64_t bytes = disk_bytes("./data");
+    std::cout << name << ": 落盘 " << bytes / 1024 << " KB (压缩比 " << (double)raw / bytes << "), "
+              << "PUT+合并 " << put / num_keys << " us/op, "
+              << "GET " << get / num_keys << " us/op" << (wrong ? ", 读到错误的值!" : "") << std::endl;
+}
+
+int main() {
+    std::vector<std::string> values = make_values();
+    run("none   ", CODEC_NONE, values);
+    run("lz     ", CODEC_LZ, values);
+    run("lz-high", CODEC_LZ_HIGH, values);
+    return 0;
+}
@@ -3,6 +3,7 @@
 #include <cstdint>
 #include <iostream>
 #include <string>
+#include <vector>
 
 #include <chrono>
 
@@ -129,6 +130,16 @@ private:
         for (i = 0; i < max; ++i)
             EXPECT((i & 1) ? std::string(i + 1, 's') : not_found, store.get(i));
 
+        // multiGet：乱序、有重复、有不存在的 key
+        std::vector<uint64_t> keys;
+        for (i = 0; i < max; ++i)
+            keys.push_back(i * 7919 % (max + max / 8));
+        keys.push_back(keys[1]);
+        std::vector<std::string> vals = store.multiGet(keys);
+        EXPECT(keys.size(), vals.size());
+        for (i = 0; i < keys.size() && i < vals.size(); ++i)
+            EXPECT(keys[i] < max && (keys[i] & 1) ? std::string(keys[i] + 1, 's') : not_found, std::string(vals[i]));
+
         for (i = 1; i < max; ++i)
             EXPECT(i & 1, store.del(i));
 
@@ -137,15 +148,106 @@ private:
         report();
     }
 
+    void snapshot_test(uint64_t max) {
+        uint64_t i;
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i + 1, 's'));
+        std::shared_ptr<const Snapshot> snapshot = store.getSnapshot();
+
+        // 快照之后改写、删除、新增，途中会落盘和合并
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i + 1, 't'));
+        for (i = 0; i < max; i += 2)
+            EXPECT(true, store.del(i));
+        for (i = max; i < max + max / 4; ++i)
+            store.put(i, std::string(i + 1, 't'));
+        phase();
+
+        // 快照看到的还是改写之前的样子
+        for (i = 0; i < max + max / 4; ++i)
+            EXPECT(i < max ? std::string(i + 1, 's') : not_found, store.get(i, *snapshot));
+        for (i = 0; i < max; ++i)
+            EXPECT((i & 1) ? std::string(i + 1, 't') : not_found, store.get(i));
+        phase();
+
+        std::list<std::pair<uint64_t, std::string>> list_stu;
+        store.scan(0, max + max / 4, list_stu, *snapshot);
+        EXPECT(max, list_stu.size());
+        i = 0;
+        for (auto &[key, val] : list_stu) {
+            EXPECT(i, key);
+            EXPECT(std::string(i + 1, 's'), val);
+            i++;
+        }
+
+        // 迭代器逐条读，不设上界时一直读到最后
+        KVStore::Iterator it = store.newIterator(snapshot);
+        for (i = 0, it.seek(max / 2); it.valid(); it.next(), i++) {
+            EXPECT(max / 2 + i, it.key());
+            EXPECT(std::string(max / 2 + i + 1, 's'), std::string(it.value()));
+        }
+        EXPECT(max - max / 2, i);
+        phase();
+
+        snapshot.reset();
+        for (i = 0; i < max; ++i)
+            store.put(i, std::string(i + 1, 'u'));
+        for (i = 0; i < max; ++i)
+            EXPECT(std::string(i + 1, 'u'), store.get(i));
+        phase();
+
+        report();
+    }
+
+    static std::string pinned_value(uint64_t i, char c) { // 8KB 左右，压缩不了
+        std::string val(8192 + i % 64, c);
+        for (size_t j = 0; j < val.size(); j += 7)
+            val[j] = 'a' + (i * 31 + j * 17) % 26;
+        return val;
+    }
+
+    // getPinned 不拷贝 value，指向的块（mmapReads 时是文件映射）在文件被合并掉删除之后仍然有效
+    void pinned_test(uint64_t max) {
+        uint64_t i;
+        for (i = 0; i < max; ++i)
+            store.put(i, pinned_value(i, 's'));
+        store.compaction();
+        for (i = 0; i < max; ++i)
+            EXPECT(pinned_value(i, 's'), std::string(store.getPinned(i).view()));
+        EXPECT(true, store.getPinned(max).empty());
+        phase();
+
+        std::vector<PinnedValue> pins;
+        for (i = 0; i < max; i += 16)
+            pins.push_back(store.getPinned(i));
+        for (i = 0; i < max; ++i)
+            store.put(i, pinned_value(i, 't'));
+        for (i = 0; i < max; i += 2)
+            EXPECT(true, store.del(i));
+        store.compaction();
+        for (i = 0; i < pins.size(); ++i)
+            EXPECT(pinned_value(16 * i, 's'), std::string(pins[i].view()));
+        for (i = 0; i < max; ++i)
+            EXPECT((i & 1) ? pinned_value(i, 't') : not_found, std::string(store.getPinned(i).view()));
+        phase();
+
+        report();
+    }
+
 public:
-    CorrectnessTest(const std::string &dir, bool v = true) : Test(dir, v) {}
+    CorrectnessTest(const std::string &dir, bool v = true, const KVStoreOptions &options = KVStoreOptions()) :
+        Test(dir, v, options) {}
+
+    void start_pinned_test() {
+        std::cout << "[Pinned Test (mmap)]" << std::endl;
+        store.reset();
+        pinned_test(1024 * 4);
+        store.reset();
+    }
 
     void start_test(void *args = NULL) override {
         std::cout << "KVStore Correctness Test" << std::endl;
 
-        // 开始计时
-        auto start_time = std::chrono::high_resolution_clock::now();
-
         store.reset();
 
         std::cout << "[Simple Test]" << std::endl;
@@ -156,6 +258,16 @@ public:
         std::cout << "[Large Test]" << std::endl;
         regular_test(1024 * 64);
 
+        store.reset();
+
+        std::cout << "[Snapshot Test]" << std::endl;
+        snapshot_test(1024 * 16);
+
+        store.reset();
+
+        std::cout << "[Pinned Test]" << std::endl;
+        pinned_test(1024 * 4);
+
         //        store.reset();
         //        std::cout << "[Insert Test]" << std::endl;
         //        insert_test(1024 * 16);
@@ -163,13 +275,6 @@ public:
         //        store.reset();
         //        std::cout << "[delete test]" << std::endl;
         //        delete_test(1024 * 64);
-        
-        // 结束计时
-        auto end_time = std::chrono::high_resolution_clock::now();
-        auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
-
-        // 输出测试总耗时
-        std::cout << "Total test time: " << duration.count() << " s" << std::endl;
     }
 };
 
@@ -182,9 +287,28 @@ int main(int argc, char *argv[]) {
     std::cout << std::endl;
     std::cout.flush();
 
-    CorrectnessTest test("./data", verbose);
+    // 开始计时，包括最后的 mmap 阶段
+    auto start_time = std::chrono::high_resolution_clock::now();
+
+    {
+        CorrectnessTest test("./data", verbose);
+        test.start_test();
+    }
+
+    // sstable 都在 ./data 下，上一个 KVStore 析构之后才能再打开一个
+    KVStoreOptions options;
+    options.mmapReads             = true;
+    options.compressionPerLevel   = {CODEC_NONE}; // 压缩的块要解压，不会直接指向映射
+    options.bottommostCompression = CODEC_NONE;
+    CorrectnessTest mapped("./data", verbose, options);
+    mapped.start_pinned_test();
+
+    // 结束计时
+    auto end_time = std::chrono::high_resolution_clock::now();
+    auto duration = std::chrono::duration_cast<std::chrono::seconds>(end_time - start_time);
 
-    test.start_test();
+    // 输出测试总耗时
+    std::cout << "Total test time: " << duration.count() << " s" << std::endl;
 
     return 0;
 }
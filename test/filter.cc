@@ -0,0 +1,201 @@
+#include "test.h"
+
+#include <cmath>
+#include <map>
+#include <random>
+#include <vector>
+
+/**
+ * sstable 过滤器的测试.
+ * bloom：每个 sstable 的 bloom 按 key 数和 bloomBitsPerKey 定大小，key 多的表 bloom 大；
+ * get 不存在的 key 时误判计数和 bloom 的误判率相符。
+ * 区间过滤器：key 分成若干簇，簇之间留着整段的空隙。scan 空隙时 sstable 应该被区间过滤器跳过（rangeSkips 增加），
+ * 而含有区间内 key 的 sstable 不能被跳过，scan 的结果要和写入的完全一样。
+ */
+class FilterTest : public Test {
+private:
+    const uint64_t CLUSTERS    = 64; // 簇 c 的 key 从 (2c << 40) 开始，簇之间空一段 1 << 40
+    const uint64_t PER_CLUSTER = 1000;
+    const uint64_t STEP        = 3; // 簇内 key 的间隔，间隔里的短区间走逐个 key 查 bloom 的路径
+
+    uint32_t bitsPerKey; // options.bloomBitsPerKey
+
+    std::string value(uint64_t key, size_t size = 100) {
+        return std::string(size, 'a' + key % 26);
+    }
+
+    void bloom_test() {
+        // 三组 key 的 value 大小不同，落盘后每个 sstable 的 key 数差别很大；组内 key 都是偶数
+        const size_t sizes[] = {64, 512, 4096};
+        uint64_t n           = 6 << 20; // 每组的 value 字节数
+        for (int g = 0; g < 3; ++g) {
+            for (uint64_t i = 0; i < n / sizes[g]; ++i) {
+                uint64_t key = (uint64_t(g) << 32) + 2 * i;
+                store.put(key, value(key, sizes[g]));
+            }
+        }
+        store.compaction();
+
+        std::vector<TableFilterStats> stats = store.getFilterStats();
+        uint64_t minKeys = UINT64_MAX, maxKeys = 0;
+        for (const TableFilterStats &st : stats) {
+            // 位数组按 64 字节的 cache line 分配
+            EXPECT(size_t((st.keys * bitsPerKey + 511) / 512 * 64), st.filterBytes);
+            EXPECT(uint32_t(std::lround(bitsPerKey * 0.69)), st.numProbes);
+            minKeys = std::min(minKeys, st.keys);
+            maxKeys = std::max(maxKeys, st.keys);
+        }
+        for (const TableFilterStats &a : stats) {
+            for (const TableFilterStats &b : stats)
+                EXPECT(true, a.keys >= b.keys || a.filterBytes <= b.filterBytes);
+        }
+        if (verbose)
+            std::cout << "  " << stats.size() << " sstables, " << minKeys << " ~ " << maxKeys << " keys" << std::endl;
+        EXPECT(true, maxKeys >= 4 * minKeys);
+
+        // 不存在的 key：过滤器说可能有的都是误判
+        uint64_t checks = 0, positives = 0, falsePositives = 0;
+        for (const TableFilterStats &st : stats) {
+            checks -= st.checks;
+            positives -= st.positives;
+            falsePositives -= st.falsePositives;
+        }
+        for (int g = 0; g < 3; ++g) {
+            for (uint64_t i = 0; i < n / sizes[g]; ++i)
+                EXPECT(not_found, store.get((uint64_t(g) << 32) + 2 * i + 1));
+        }
+        for (const TableFilterStats &st : store.getFilterStats()) {
+            checks += st.checks;
+            positives += st.positives;
+            falsePositives += st.falsePositives;
+        }
+        if (verbose)
+            std::cout << "  " << checks << " checks, " << falsePositives << " false positives" << std::endl;
+        EXPECT(true, checks > 0);
+        EXPECT(positives, falsePositives);
+        // 10 位以上每 key 的理论误判率不到 1%，留几倍余量
+        EXPECT(true, falsePositives * 100 <= checks * 3);
+
+        phase();
+    }
+
+    void rangeStats(uint64_t &checks, uint64_t &skips) {
+        checks = skips = 0;
+        for (const TableFilterStats &st : store.getFilterStats()) {
+            checks += st.rangeChecks;
+            skips += st.rangeSkips;
+        }
+    }
+
+    void range_test() {
+        std::map<uint64_t, std::string> expected;
+        for (uint64_t c = 0; c < CLUSTERS; ++c) {
+            for (uint64_t j = 0; j < PER_CLUSTER; ++j) {
+                uint64_t key = (2 * c << 40) + j * STEP;
+                expected[key] = value(key);
+                store.put(key, value(key));
+            }
+        }
+        store.compaction();
+
+        uint64_t checks0, skips0, checks1, skips1;
+        std::list<std::pair<uint64_t, std::string>> list;
+
+        // 没有 key 的区间：簇之间的空隙和簇内的短间隔
+        rangeStats(checks0, skips0);
+        for (uint64_t c = 0; c + 1 < CLUSTERS; ++c) {
+            list.clear();
+            store.scan((2 * c + 1) << 40, ((2 * c + 2) << 40) - 1, list);
+            EXPECT(size_t(0), list.size());
+            uint64_t key = (2 * c << 40) + c * STEP;
+            list.clear();
+            store.scan(key + 1, key + STEP - 1, list);
+            EXPECT(size_t(0), list.size());
+        }
+        rangeStats(checks1, skips1);
+        if (verbose)
+            std::cout << "  empty ranges: " << checks1 - checks0 << " checks, " << skips1 - skips0 << " skips"
+                      << std::endl;
+        // 误判率在几个百分点以内，绝大多数检查都应该跳过
+        EXPECT(true, checks1 > checks0);
+        EXPECT(true, (skips1 - skips0) * 10 >= (checks1 - checks0) * 9);
+
+        // 有 key 的区间：各种宽度，跨簇、跨空隙，结果必须完整
+        std::mt19937_64 rng(2024);
+        uint64_t maxKey = expected.rbegin()->first;
+        for (int i = 0; i < 2000; ++i) {
+            uint64_t lo, hi;
+            switch (i % 4) {
+            case 0: // 单个 key
+                lo = hi = std::next(expected.begin(), rng() % expected.size())->first;
+                break;
+            case 1: // 簇内的短区间
+                hi = std::next(expected.begin(), rng() % expected.size())->first;
+                lo = hi - std::min<uint64_t>(hi, rng() % STEP);
+                hi = lo + rng() % 16;
+                break;
+            case 2: // 簇内的长区间
+                lo = std::next(expected.begin(), rng() % expected.size())->first;
+                hi = lo + rng() % (PER_CLUSTER * STEP);
+                break;
+            default: // 从空隙开始，跨过若干簇
+                lo = ((2 * (rng() % CLUSTERS) + 1) << 40) + rng() % (1ull << 40);
+                hi = lo + (rng() % 4 << 41);
+                break;
+            }
+            hi = std::min(hi, maxKey + 1);
+            list.clear();
+            store.scan(lo, hi, list);
+            auto first = expected.lower_bound(lo), last = expected.upper_bound(hi);
+            EXPECT(size_t(std::distance(first, last)), list.size());
+            EXPECT(true, std::equal(list.begin(), list.end(), first, last, [](auto &a, auto &b) {
+                       return a.first == b.first && a.second == b.second;
+                   }));
+        }
+
+        phase();
+    }
+
+public:
+    FilterTest(const std::string &dir, bool v = true, const KVStoreOptions &options = KVStoreOptions()) :
+        Test(dir, v, options),
+        bitsPerKey(options.bloomBitsPerKey) {}
+
+    void start_test(void *args = NULL) override {
+        std::cout << "KVStore Filter Test" << std::endl;
+
+        store.reset();
+
+        std::cout << "[Bloom Filter Test]" << std::endl;
+        bloom_test();
+
+        store.reset();
+
+        std::cout << "[Range Filter Test]" << std::endl;
+        range_test();
+
+        store.reset();
+
+        report();
+    }
+};
+
+int main(int argc, char *argv[]) {
+    bool verbose = (argc == 2 && std::string(argv[1]) == "-v");
+
+    std::cout << "Usage: " << argv[0] << " [-v]" << std::endl;
+    std::cout << "  -v: print extra info for failed tests [currently ";
+    std::cout << (verbose ? "ON" : "OFF") << "]" << std::endl;
+    std::cout << std::endl;
+    std::cout.flush();
+
+    KVStoreOptions options;
+    options.bloomBitsPerKey      = 12; // 不用默认的 10，确认大小跟着配置走
+    options.filterPolicyPerLevel = {FILTER_BLOOM}; // 每层都用 bloom，才能按 bloomBitsPerKey 核对大小
+
+    FilterTest test("./data", verbose, options);
+
+    test.start_test();
+
+    return 0;
+}
@@ -0,0 +1,67 @@
+#include "skiplist.h"
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <random>
+
+/* memtable 写入路径的微基准：先 search 再插入（两次遍历并拷贝旧值）与一次遍历的 upsert */
+
+const int num_keys = 200000;
+const int rounds   = 5;
+
+static double measure_us(const std::function<void()> &func) {
+    auto start = std::chrono::high_resolution_clock::now();
+    func();
+    auto end = std::chrono::high_resolution_clock::now();
+    return std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
+}
+
+/* 旧的写入路径：为了算字节数先查一次旧值，再插入 */
+static void search_then_upsert(skiplist &s, uint64_t key, const std::string &val, uint64_t &delta) {
+    std::string old = s.search(key);
+    delta += old.length() ? val.length() - old.length() : 12 + val.length();
+    s.upsert(key, val);
+}
+
+static void upsert_only(skiplist &s, uint64_t key, const std::string &val, uint64_t &delta) {
+    int64_t old = s.upsert(key, val);
+    delta += old >= 0 ? val.length() - old : 12 + val.length();
+}
+
+using writeFunc = void (*)(skiplist &, uint64_t, const std::string &, uint64_t &);
+
+/* 字节数或读出的 value 不对时返回 false */
+static bool run(const std::string &name, writeFunc write, const std::vector<uint64_t> &keys) {
+    std::vector<std::string> values = {std::string(100, 'a'), std::string(120, 'b')};
+    double insert = 0, update = 0;
+    bool wrong    = false;
+    for (int r = 0; r < rounds; ++r) {
+        skiplist s(0.5);
+        uint64_t delta = 0;
+        insert += measure_us([&]() {
+            for (uint64_t key : keys)
+                write(s, key, values[0], delta);
+        });
+        update += measure_us([&]() { // 每个 key 改写一次，value 变长
+            for (uint64_t key : keys)
+                write(s, key, values[1], delta);
+        });
+        // upsert 之后 getBytes 要和按旧值算出的增量一致（跳表里每个 key 记 8 字节）
+        wrong |= s.getBytes() != delta - 4 * keys.size();
+        wrong |= s.search(keys[0]) != values[1];
+    }
+    std::cout << name << ": 插入 " << insert * 1000 / rounds / keys.size() << " ns/op, "
+              << "更新 " << update * 1000 / rounds / keys.size() << " ns/op" << (wrong ? ", 字节数不一致!" : "")
+              << std::endl;
+    return !wrong;
+}
+
+int main() {
+    std::mt19937_64 rng(2024);
+    std::vector<uint64_t> keys(num_keys);
+    for (auto &key : keys)
+        key = rng();
+    bool ok = run("search + upsert", search_then_upsert, keys);
+    ok &= run("upsert         ", upsert_only, keys);
+    return ok ? 0 : 1;
+}
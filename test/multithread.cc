@@ -0,0 +1,113 @@
+#include "test.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+/**
+ * 多个写者同时 put 的测试.
+ * 32 个写者各自按顺序写一组新 key（key = i * 写者数 + 写者编号），写完立刻 get 自己的 key；
+ * 同时一个读者不停建快照，scan 随机的一段，memtable 在这期间反复切换、合并换掉 Version。
+ * 快照里每个写者在这一段中的 key 必须是从段首开始连续的，同一个快照 scan 两次结果要一样；最后每个 key 都要读得到。
+ */
+class MultiThreadTest : public Test {
+private:
+    const int WRITERS = 32;
+
+    std::string value(uint64_t key) {
+        return std::string(64 + key % 128, 'a' + key % 26);
+    }
+
+    void put_test(uint64_t n) {
+        std::atomic<bool> done{false};
+        std::atomic<uint64_t> errors{0}, snapshots{0};
+        uint64_t total = n * WRITERS;
+
+        std::vector<std::thread> writers;
+        for (int w = 0; w < WRITERS; ++w) {
+            writers.emplace_back([&, w] {
+                for (uint64_t i = 0; i < n; ++i) {
+                    uint64_t key = i * WRITERS + w;
+                    store.put(key, value(key));
+                    if (store.get(key) != value(key))
+                        ++errors;
+                }
+            });
+        }
+
+        std::thread reader([&] {
+            std::mt19937_64 rng(1);
+            const uint64_t span = 64; // 每个写者在一段中的 key 数
+            while (!done) {
+                uint64_t start = rng() % (n - span + 1);
+                uint64_t lo = start * WRITERS, hi = lo + span * WRITERS - 1;
+                std::shared_ptr<const Snapshot> snapshot = store.getSnapshot();
+                std::list<std::pair<uint64_t, std::string>> first, second;
+                store.scan(lo, hi, first, *snapshot);
+                std::vector<uint64_t> next(WRITERS, start); // 每个写者下一个应该出现的 i
+                for (auto &[key, val] : first) {
+                    if (val != value(key) || key / WRITERS != next[key % WRITERS]++)
+                        ++errors;
+                }
+                for (int w = 0; w < WRITERS; ++w) {
+                    uint64_t key = next[w] * WRITERS + w; // 快照之后才写的 key，在快照中读不到
+                    if (next[w] < start + span && store.get(key, *snapshot) != not_found)
+                        ++errors;
+                }
+                store.scan(lo, hi, second, *snapshot);
+                if (first != second)
+                    ++errors;
+                ++snapshots;
+            }
+        });
+
+        for (std::thread &t : writers)
+            t.join();
+        done = true;
+        reader.join();
+
+        if (verbose)
+            std::cout << "  snapshots: " << snapshots << std::endl;
+        EXPECT(uint64_t(0), errors.load());
+        for (uint64_t key = 0; key < total; ++key)
+            EXPECT(value(key), store.get(key));
+        std::list<std::pair<uint64_t, std::string>> list;
+        store.scan(0, total, list);
+        EXPECT(size_t(total), list.size());
+
+        phase();
+    }
+
+public:
+    MultiThreadTest(const std::string &dir, bool v = true) : Test(dir, v) {}
+
+    void start_test(void *args = NULL) override {
+        std::cout << "KVStore Multi-thread Test" << std::endl;
+
+        store.reset();
+
+        std::cout << "[Concurrent Put Test]" << std::endl;
+        put_test(2000);
+
+        store.reset();
+
+        report();
+    }
+};
+
+int main(int argc, char *argv[]) {
+    bool verbose = (argc == 2 && std::string(argv[1]) == "-v");
+
+    std::cout << "Usage: " << argv[0] << " [-v]" << std::endl;
+    std::cout << "  -v: print extra info for failed tests [currently ";
+    std::cout << (verbose ? "ON" : "OFF") << "]" << std::endl;
+    std::cout << std::endl;
+    std::cout.flush();
+
+    MultiThreadTest test("./data", verbose);
+
+    test.start_test();
+
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include "test.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <vector>
+
+/**
+ * 读写并发的压力测试，可以在 -fsanitize=thread 下跑.
+ * 8 个写者各自覆盖写一组 key，value 里带着 key 和轮数；3 个读者同时用 get、快照 scan 和 multiGet 读，
+ * 期间 memtable 不断切换、后台不断合并。读到的 value 必须属于这个 key，同一个 key 的轮数不能倒退，
+ * 同一个快照 scan 两次结果要一样。最后每个 key 都是最后一轮的值。
+ */
+class StressTest : public Test {
+private:
+    const int WRITERS     = 8;
+    const uint64_t KEYS   = 2000; // 每个写者
+    const int ROUNDS      = 20;
+    const size_t VAL_SIZE = 200;
+
+    std::string value(uint64_t key, int round) {
+        std::string res = std::to_string(key) + ":" + std::to_string(round) + ":";
+        res.resize(VAL_SIZE, 'a' + key % 26);
+        return res;
+    }
+
+    int roundOf(uint64_t key, const std::string &val) { // 不是这个 key 的 value 返回 -2，空串返回 -1
+        if (val.empty())
+            return -1;
+        size_t a = val.find(':'), b = val.find(':', a + 1);
+        if (a == std::string::npos || b == std::string::npos || val.substr(0, a) != std::to_string(key))
+            return -2;
+        int round = std::stoi(val.substr(a + 1, b - a - 1));
+        return val == value(key, round) ? round : -2;
+    }
+
+    void stress_test() {
+        std::atomic<bool> done{false};
+        std::atomic<uint64_t> errors{0}, reads{0};
+        uint64_t total = WRITERS * KEYS;
+
+        std::vector<std::thread> writers;
+        for (int w = 0; w < WRITERS; ++w) {
+            writers.emplace_back([&, w] {
+                for (int round = 0; round < ROUNDS; ++round) {
+                    for (uint64_t i = 0; i < KEYS; ++i) {
+                        uint64_t key = i * WRITERS + w;
+                        store.put(key, value(key, round));
+                    }
+                }
+            });
+        }
+
+        std::vector<std::thread> readers;
+        readers.emplace_back([&] { // get
+            std::mt19937_64 rng(1);
+            std::vector<int> seen(total, -1);
+            while (!done) {
+                uint64_t key = rng() % total;
+                int round    = roundOf(key, store.get(key));
+                if (round < -1 || round < seen[key])
+                    ++errors;
+                seen[key] = std::max(seen[key], round);
+                ++reads;
+            }
+        });
+        readers.emplace_back([&] { // 快照 scan
+            std::mt19937_64 rng(2);
+            while (!done) {
+                uint64_t lo = rng() % total, hi = lo + rng() % 2000;
+                std::shared_ptr<const Snapshot> snapshot = store.getSnapshot();
+                std::list<std::pair<uint64_t, std::string>> first, second;
+                store.scan(lo, hi, first, *snapshot);
+                store.scan(lo, hi, second, *snapshot);
+                if (first != second)
+                    ++errors;
+                for (auto &[key, val] : first) {
+                    if (key < lo || key > hi || roundOf(key, val) < 0)
+                        ++errors;
+                }
+                ++reads;
+            }
+        });
+        readers.emplace_back([&] { // multiGet
+            std::mt19937_64 rng(3);
+            std::vector<int> seen(total, -1);
+            while (!done) {
+                std::vector<uint64_t> keys(64);
+                for (uint64_t &key : keys)
+                    key = rng() % total;
+                std::vector<std::string> vals = store.multiGet(keys);
+                for (size_t i = 0; i < keys.size(); ++i) {
+                    int round = roundOf(keys[i], vals[i]);
+                    if (round < -1 || round < seen[keys[i]])
+                        ++errors;
+                    seen[keys[i]] = std::max(seen[keys[i]], round);
+                }
+                ++reads;
+            }
+        });
+
+        for (std::thread &t : writers)
+            t.join();
+        done = true;
+        for (std::thread &t : readers)
+            t.join();
+
+        if (verbose)
+            std::cout << "  reads: " << reads << std::endl;
+        EXPECT(uint64_t(0), errors.load());
+        for (uint64_t key = 0; key < total; ++key)
+            EXPECT(value(key, ROUNDS - 1), store.get(key));
+
+        phase();
+    }
+
+public:
+    StressTest(const std::string &dir, bool v = true) : Test(dir, v) {}
+
+    void start_test(void *args = NULL) override {
+        std::cout << "KVStore Stress Test" << std::endl;
+
+        store.reset();
+
+        std::cout << "[Concurrent Read/Write Test]" << std::endl;
+        stress_test();
+
+        store.reset();
+
+        report();
+    }
+};
+
+int main(int argc, char *argv[]) {
+    bool verbose = (argc == 2 && std::string(argv[1]) == "-v");
+
+    std::cout << "Usage: " << argv[0] << " [-v]" << std::endl;
+    std::cout << "  -v: print extra info for failed tests [currently ";
+    std::cout << (verbose ? "ON" : "OFF") << "]" << std::endl;
+    std::cout << std::endl;
+    std::cout.flush();
+
+    StressTest test("./data", verbose);
+
+    test.start_test();
+
+    return 0;
+}
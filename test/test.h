@@ -64,7 +64,9 @@ protected:
     bool verbose;
 
 public:
-    Test(const std::string &dir, bool v = true) : store(dir), verbose(v) {
+    Test(const std::string &dir, bool v = true, const KVStoreOptions &options = KVStoreOptions()) :
+        store(dir, options),
+        verbose(v) {
         nr_tests         = 0;
         nr_passed_tests  = 0;
         nr_phases        = 0;
@@ -0,0 +1,55 @@
+#include "xorfilter.h"
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+/* binary fuse filter 的测试：建进去的 key 一定能查到，不在其中的 key 误判率接近 1/256，编码之后读回来结果不变 */
+
+const int probes       = 1000000;   // 每种 key 数下查询的不存在的 key 数
+const double maxFpRate = 2.0 / 256; // 8 位指纹的理论误判率是 1/256，留一倍余量
+
+static bool check(size_t n) {
+    std::mt19937_64 rng(n + 1);
+    std::vector<uint64_t> keys(n);
+    for (uint64_t &key : keys)
+        key = rng();
+    if (n > 1)
+        keys.push_back(keys[0]); // 重复的 key
+    xorFilter filter(keys);
+
+    std::string buf;
+    filter.encode(buf);
+    xorFilter loaded;
+    // 空的 filter 编码为空，和 tableFilter 一样这时不 decode
+    bool ok = buf.size() == filter.size() && (buf.empty() || loaded.decode(buf.data(), buf.size()));
+
+    size_t missing = 0; // 漏掉的 key，必须为 0
+    for (uint64_t key : keys)
+        missing += !filter.search(key) + !loaded.search(key);
+
+    size_t falsePositives = 0, differ = 0;
+    for (int i = 0; i < probes; ++i) {
+        uint64_t key = rng(); // 和 keys 重复的概率可以忽略
+        falsePositives += filter.search(key);
+        differ += filter.search(key) != loaded.search(key);
+    }
+    double rate = double(falsePositives) / probes;
+
+    if (n == 0)
+        ok &= filter.size() == 0 && rate == 1; // 空的 filter 不排除任何 key
+    else
+        ok &= filter.size() > 0 && rate <= maxFpRate;
+    ok &= missing == 0 && differ == 0;
+
+    std::cout << "[" << n << " keys] " << filter.size() << " bytes, false positive rate " << rate
+              << (ok ? " [PASS]" : " [FAIL]") << std::endl;
+    return ok;
+}
+
+int main() {
+    bool ok = true;
+    for (size_t n : {0, 1, 2, 100, 10000, 1000000})
+        ok &= check(n);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,54 @@
+#include "version.h"
+
+#include "utils.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+TableMeta::~TableMeta() {
+    TableCache *cache = obsoleteIn.load(std::memory_order_relaxed);
+    if (cache == nullptr)
+        return;
+    cache->evict(filename); // 慢读者可能又把它打开放回了缓存
+    if (utils::rmfile(filename.data()) != 0) {
+        std::cout << "delete fail!" << std::endl;
+        std::cout << strerror(errno) << std::endl;
+    }
+}
+
+void Version::add(int level, TableRef table) {
+    levels[level].push_back(std::move(table));
+    totalLevel = std::max(totalLevel, level);
+}
+
+TableRef Version::remove(const std::string &filename) {
+    for (int level = 0; level <= totalLevel; ++level) {
+        auto &ssts = levels[level];
+        for (auto it = ssts.begin(); it != ssts.end(); ++it) {
+            if ((*it)->getFilename() == filename) {
+                TableRef res = *it;
+                ssts.erase(it);
+                return res;
+            }
+        }
+    }
+    return nullptr;
+}
+
+/* 按 minV 排序，level >= 1 的 sstable 互不相交，排好后 maxV 也是有序的 */
+void Version::sortLevel(int level) {
+    std::sort(levels[level].begin(), levels[level].end(), [](const TableRef &a, const TableRef &b) {
+        return a->getMinV() < b->getMinV();
+    });
+}
+
+/* 在 level >= 1 中二分 */
+int Version::findTable(int level, uint64_t key) const {
+    auto &ssts = levels[level];
+    auto it    = std::lower_bound(ssts.begin(), ssts.end(), key, [](const TableRef &a, uint64_t key) {
+        return a->getMaxV() < key;
+    });
+    return it - ssts.begin();
+}
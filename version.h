@@ -0,0 +1,57 @@
+#pragma once
+
+#ifndef LSM_KV_VERSION_H
+#define LSM_KV_VERSION_H
+#include "sstablehead.h"
+#include "tablecache.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+const int MAX_LEVELS = 15;
+
+/**
+ * Version 中的一个 sstable，各个 Version 共享同一份 head（bloom 和索引只有一份）.
+ * 被合并掉时只标记 obsolete，最后一个持有它的 Version 释放时才把句柄移出 TableCache 并删除文件，
+ * 所以拿着旧 Version 的读者总能按文件名打开它。在那之前新文件不能重用这个文件名。
+ */
+class TableMeta : public sstablehead {
+public:
+    explicit TableMeta(sstablehead head) : sstablehead(std::move(head)) {}
+
+    ~TableMeta();
+
+    TableMeta(const TableMeta &)            = delete;
+    TableMeta &operator=(const TableMeta &) = delete;
+
+    void markObsolete(TableCache &cache) const {
+        obsoleteIn.store(&cache, std::memory_order_relaxed);
+    }
+
+private:
+    mutable std::atomic<TableCache *> obsoleteIn{nullptr}; // 不为空表示已经被合并掉
+};
+
+using TableRef = std::shared_ptr<const TableMeta>;
+
+/**
+ * 某一时刻每层有哪些 sstable，发布之后不再修改.
+ *
+ * flush 和合并在 mtx 下复制当前 Version（只复制 TableRef）、改好之后整个换上去；
+ * 读者拿到 shared_ptr 就可以放锁，之后不论读多久看到的文件集合都不变。
+ */
+class Version {
+public:
+    std::vector<TableRef> levels[MAX_LEVELS]; // level-0 按时间戳从旧到新，level >= 1 按 minV 排序且互不相交
+    int totalLevel = -1;                      // 层数
+
+    void add(int level, TableRef table);          // 加在该层末尾，level >= 1 加完要 sortLevel
+    TableRef remove(const std::string &filename); // 没有这个文件返回 nullptr
+    void sortLevel(int level);
+    int findTable(int level, uint64_t key) const; // level >= 1 中第一个 maxV >= key 的下标，没有则返回该层大小
+};
+
+#endif // LSM_KV_VERSION_H